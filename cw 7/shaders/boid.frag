@@ -3,13 +3,14 @@
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 FragTexCoords;
+flat in float TextureLayer;
 
 out vec4 FragColor;
 
 uniform vec3 lightPos;
 uniform vec3 viewPos;
 uniform vec3 lightColor;
-uniform sampler2D colorTexture;
+uniform sampler2DArray boidTextures;
 
 void main()
 {
@@ -25,7 +26,7 @@ void main()
     vec3 diffuse = diff * lightColor;
     vec3 specular = spec * lightColor;
 
-    vec3 textureColor = texture(colorTexture, vec2(FragTexCoords.x, 1.0 - FragTexCoords.y)).rgb;
+    vec3 textureColor = texture(boidTextures, vec3(FragTexCoords.x, 1.0 - FragTexCoords.y, TextureLayer)).rgb;
 
     vec3 result = (ambient + diffuse + specular) * textureColor;
 
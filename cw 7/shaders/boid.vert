@@ -3,20 +3,24 @@
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texCoords;
+layout (location = 5) in mat4 instanceModel;
+layout (location = 9) in float instanceLayer;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 FragTexCoords;
+flat out float TextureLayer;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
-    FragPos = vec3(model * vec4(position, 1.0));
-    Normal = normalize(mat3(transpose(inverse(model))) * normal);
+    FragPos = vec3(instanceModel * vec4(position, 1.0));
+    // boid model matrices only rotate and scale uniformly, so no inverse-transpose is needed
+    Normal = normalize(mat3(instanceModel) * normal);
     FragTexCoords = texCoords;
+    TextureLayer = instanceLayer;
 
-    gl_Position = projection * view * model * vec4(position, 1.0);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
 }
@@ -2,19 +2,19 @@
 
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
+layout (location = 5) in mat4 instanceModel;
 
 out vec3 FragPos;
 out vec3 Normal;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
-    FragPos = vec3(model * vec4(position, 1.0));
+    FragPos = vec3(instanceModel * vec4(position, 1.0));
 
-    Normal = normalize(mat3(transpose(inverse(model))) * normal);
+    Normal = normalize(mat3(instanceModel) * normal);
 
-    gl_Position = projection * view * model * vec4(position, 1.0);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
 }
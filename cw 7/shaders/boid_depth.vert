@@ -0,0 +1,13 @@
+#version 410 core
+layout (location = 0) in vec3 position;
+layout (location = 5) in mat4 instanceModel;
+layout (location = 9) in float instanceLayer;
+
+out vec3 WorldPos;
+flat out int Cascade;
+
+void main()
+{
+    WorldPos = vec3(instanceModel * vec4(position, 1.0));
+    Cascade = int(instanceLayer);
+}
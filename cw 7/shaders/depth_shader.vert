@@ -1,10 +1,22 @@
 #version 410 core
-layout (location = 0) in vec3 aPos;
+layout (location = 0) in float aHeight;
 
 uniform mat4 model;
-uniform mat4 lightSpaceMatrix;
+
+uniform int gridResolution;
+uniform vec2 gridOrigin;
+uniform float gridSpacing;
+uniform vec2 heightRange;
+
+out vec3 WorldPos;
+flat out int Cascade;
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    vec2 cell = vec2(gl_VertexID % (gridResolution + 1), gl_VertexID / (gridResolution + 1));
+    vec2 xz = gridOrigin + cell * gridSpacing;
+    vec3 aPos = vec3(xz.x, heightRange.x + aHeight * heightRange.y, xz.y);
+
+    WorldPos = vec3(model * vec4(aPos, 1.0));
+    Cascade = gl_InstanceID;
 }
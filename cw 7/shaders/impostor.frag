@@ -0,0 +1,42 @@
+#version 410 core
+
+in vec3 FragPos;
+in vec2 AtlasCoords;
+in mat3 ObjectToWorld;
+flat in float TextureLayer;
+
+out vec4 FragColor;
+
+uniform vec3 lightPos;
+uniform vec3 viewPos;
+uniform vec3 lightColor;
+uniform sampler2DArray boidTextures;
+uniform sampler2D impostorUV;
+uniform sampler2D impostorNormal;
+
+void main()
+{
+    vec4 normalSample = texture(impostorNormal, AtlasCoords);
+    if (normalSample.a < 0.5)
+        discard;
+    vec2 texCoords = texture(impostorUV, AtlasCoords).xy;
+
+    // same shading as boid.frag
+    vec3 norm = normalize(ObjectToWorld * (normalSample.xyz * 2.0 - 1.0));
+    vec3 lightDir = normalize(lightPos - FragPos);
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);
+
+    float diff = max(dot(norm, lightDir), 0.0);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0);
+
+    vec3 ambient = 0.1 * lightColor;
+    vec3 diffuse = diff * lightColor;
+    vec3 specular = spec * lightColor;
+
+    vec3 textureColor = texture(boidTextures, vec3(texCoords.x, 1.0 - texCoords.y, TextureLayer)).rgb;
+
+    vec3 result = (ambient + diffuse + specular) * textureColor;
+
+    FragColor = vec4(result, 1.0);
+}
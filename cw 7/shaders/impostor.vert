@@ -0,0 +1,58 @@
+#version 410 core
+
+// quad corner in [-1, 1]
+layout (location = 0) in vec2 corner;
+layout (location = 5) in mat4 instanceModel;
+layout (location = 9) in float instanceLayer;
+
+out vec3 FragPos;
+out vec2 AtlasCoords;
+out mat3 ObjectToWorld;
+flat out float TextureLayer;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPos;
+uniform int impostorTiles;
+uniform float impostorRadius;
+
+vec2 encodeOctahedral(vec3 v)
+{
+    v /= abs(v.x) + abs(v.y) + abs(v.z);
+    vec2 p = v.xy;
+    if (v.z < 0.0)
+        p = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    return p;
+}
+
+vec3 decodeOctahedral(vec2 p)
+{
+    vec3 v = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+
+void main()
+{
+    vec3 center = instanceModel[3].xyz;
+    float scale = length(instanceModel[0].xyz);
+    mat3 rotation = mat3(instanceModel) / scale;
+
+    // nearest baked view of the direction towards the camera, in object space
+    vec3 toCamera = transpose(rotation) * normalize(viewPos - center);
+    vec2 tile = clamp(floor((encodeOctahedral(toCamera) * 0.5 + 0.5) * impostorTiles), 0.0, float(impostorTiles - 1));
+    vec3 direction = decodeOctahedral((tile + 0.5) / impostorTiles * 2.0 - 1.0);
+
+    // same basis as glm::lookAt in ImpostorAtlas::bake
+    vec3 upReference = abs(direction.y) > 0.99 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(upReference, direction));
+    vec3 up = cross(direction, right);
+
+    FragPos = center + rotation * (right * corner.x + up * corner.y) * impostorRadius * scale;
+    AtlasCoords = (tile + corner * 0.5 + 0.5) / impostorTiles;
+    ObjectToWorld = rotation;
+    TextureLayer = instanceLayer;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,13 @@
+#version 410 core
+
+in vec3 Normal;
+in vec2 TexCoords;
+
+layout (location = 0) out vec2 UVOut;
+layout (location = 1) out vec4 NormalOut;
+
+void main()
+{
+    UVOut = TexCoords;
+    NormalOut = vec4(normalize(Normal) * 0.5 + 0.5, 1.0);
+}
@@ -0,0 +1,17 @@
+#version 410 core
+
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec2 texCoords;
+
+out vec3 Normal;
+out vec2 TexCoords;
+
+uniform mat4 viewProjection;
+
+void main()
+{
+    Normal = normal;
+    TexCoords = texCoords;
+    gl_Position = viewProjection * vec4(position, 1.0);
+}
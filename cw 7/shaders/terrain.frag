@@ -4,11 +4,18 @@ out vec4 FragColor;
 in vec2 TexCoords;
 in vec3 FragPos;
 in mat3 TBN;
-in vec4 FragPosLightSpace;
+in float ViewDepth;
+
+const int MAX_CASCADES = 4;
 
 uniform sampler2D terrainTexture;
 uniform sampler2D normalMap;
-uniform sampler2D shadowMap;
+uniform sampler2DArray shadowMap;
+
+uniform mat4 lightSpaceMatrices[MAX_CASCADES];
+uniform float cascadeSplits[MAX_CASCADES];
+uniform float cascadeDepthBias[MAX_CASCADES];
+uniform int cascadeCount;
 
 uniform vec3 lightPos;
 uniform vec3 lightColor;
@@ -18,20 +25,33 @@ uniform float ambientStrength = 0.2;
 uniform float specularStrength = 0.5;
 uniform float shininess = 32.0;
 
-float ShadowCalculation(vec4 fragPosLightSpace) {
+float ShadowCalculation() {
+    int cascade = -1;
+    for (int i = 0; i < cascadeCount; ++i) {
+        if (ViewDepth < cascadeSplits[i]) {
+            cascade = i;
+            break;
+        }
+    }
+    if (cascade < 0)
+        return 0.0;
+
+    vec4 fragPosLightSpace = lightSpaceMatrices[cascade] * vec4(FragPos, 1.0);
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     projCoords = projCoords * 0.5 + 0.5;
 
-    float closestDepth = texture(shadowMap, projCoords.xy).r;
     float currentDepth = projCoords.z;
+    if (currentDepth > 1.0)
+        return 0.0;
 
-    float bias = max(0.01 * (1.0 - dot(normalize(TBN[2]), normalize(lightPos - FragPos))), 0.0005);
+    float slope = 1.0 - max(dot(normalize(TBN[2]), normalize(lightPos - FragPos)), 0.0);
+    float bias = cascadeDepthBias[cascade] * (1.5 + 4.0 * slope);
 
     float shadow = 0.0;
-    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
     for (int x = -1; x <= 1; ++x) {
         for (int y = -1; y <= 1; ++y) {
-            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
+            float pcfDepth = texture(shadowMap, vec3(projCoords.xy + vec2(x, y) * texelSize, cascade)).r;
             shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
         }
     }
@@ -41,8 +61,9 @@ float ShadowCalculation(vec4 fragPosLightSpace) {
 }
 
 void main() {
-    vec3 normal = texture(normalMap, TexCoords).rgb;
-    normal = normalize(normal * 2.0 - 1.0);
+    // only x and y are stored (RGTC2), z follows from the unit length
+    vec2 normalXY = texture(normalMap, TexCoords).rg * 2.0 - 1.0;
+    vec3 normal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
     normal = normalize(TBN * normal);
 
     vec3 lightDir = normalize(lightPos - FragPos);
@@ -55,7 +76,7 @@ void main() {
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
     vec3 specular = specularStrength * spec * lightColor;
 
-    float shadow = ShadowCalculation(FragPosLightSpace);
+    float shadow = ShadowCalculation();
 
     vec3 textureColor = texture(terrainTexture, TexCoords).rgb;
     vec3 lighting = (ambientStrength + (1.0 - shadow) * (diffuse + specular)) * textureColor;
@@ -1,30 +1,53 @@
 #version 410 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec2 aTexCoords;
-layout (location = 2) in vec3 aNormal;
-layout (location = 3) in vec3 aTangent;
-layout (location = 4) in vec3 aBitangent;
+layout (location = 0) in float aHeight;
+layout (location = 1) in float aBitangentSign;
+layout (location = 2) in vec2 aNormal;
+layout (location = 3) in vec2 aTangent;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+
+uniform int gridResolution;
+uniform vec2 gridOrigin;
+uniform float gridSpacing;
+uniform vec2 heightRange;
+uniform vec2 uvOffset;
 
 out vec2 TexCoords;
 out vec3 FragPos;
 out mat3 TBN;
-out vec4 FragPosLightSpace;
+out float ViewDepth;
+
+vec3 decodeOctahedral(vec2 p)
+{
+    vec3 v = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
 
 void main()
 {
+    // x/z and UVs come from the vertex's place in the (gridResolution + 1)^2 grid
+    vec2 cell = vec2(gl_VertexID % (gridResolution + 1), gl_VertexID / (gridResolution + 1));
+    vec2 xz = gridOrigin + cell * gridSpacing;
+    vec3 aPos = vec3(xz.x, heightRange.x + aHeight * heightRange.y, xz.y);
+
     FragPos = vec3(model * vec4(aPos, 1.0));
-    TexCoords = aTexCoords;
-    FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
+    TexCoords = uvOffset + cell / float(gridResolution);
+
+    vec3 normal = decodeOctahedral(aNormal);
+    vec3 tangent = decodeOctahedral(aTangent);
+    vec3 bitangent = cross(normal, tangent) * aBitangentSign;
 
-    vec3 T = normalize(mat3(model) * aTangent);
-    vec3 B = normalize(mat3(model) * aBitangent);
-    vec3 N = normalize(mat3(model) * aNormal);
+    vec3 T = normalize(mat3(model) * tangent);
+    vec3 B = normalize(mat3(model) * bitangent);
+    vec3 N = normalize(mat3(model) * normal);
     TBN = mat3(T, B, N);
 
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    vec4 viewPos = view * vec4(FragPos, 1.0);
+    ViewDepth = -viewPos.z;
+
+    gl_Position = projection * viewPos;
 }
@@ -1,22 +1,24 @@
 #version 410 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec2 aTexCoords;
-layout (location = 2) in vec3 aNormal;
-layout (location = 3) in vec3 aTangent;
-layout (location = 4) in vec3 aBitangent;
+layout (location = 0) in float aHeight;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+
+uniform int gridResolution;
+uniform vec2 gridOrigin;
+uniform float gridSpacing;
+uniform vec2 heightRange;
+uniform vec2 uvOffset;
 
 out vec2 TexCoords;
-out vec3 FragPos;
-out mat3 TBN;
-out vec4 FragPosLightSpace;
 
 void main()
 {
+    vec2 cell = vec2(gl_VertexID % (gridResolution + 1), gl_VertexID / (gridResolution + 1));
+    vec2 xz = gridOrigin + cell * gridSpacing;
+    vec3 aPos = vec3(xz.x, heightRange.x + aHeight * heightRange.y, xz.y);
+
     gl_Position = projection * view * model * vec4(aPos, 1.0f);
-    TexCoords = aTexCoords;
-}
\ No newline at end of file
+    TexCoords = uvOffset + cell / float(gridResolution);
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Core
+{
+	// Plik zmapowany w pamieci tylko do odczytu. Dane sa dostepne do zniszczenia obiektu.
+	class MappedFile
+	{
+	public:
+		MappedFile() {}
+
+		explicit MappedFile(const std::string& path)
+		{
+			open(path);
+		}
+
+		~MappedFile()
+		{
+			close();
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		MappedFile(MappedFile&& other)
+		{
+			*this = std::move(other);
+		}
+
+		MappedFile& operator=(MappedFile&& other)
+		{
+			if (this != &other)
+			{
+				close();
+				std::swap(bytes, other.bytes);
+				std::swap(length, other.length);
+#ifdef _WIN32
+				std::swap(file, other.file);
+				std::swap(mapping, other.mapping);
+#else
+				std::swap(descriptor, other.descriptor);
+#endif
+			}
+			return *this;
+		}
+
+		// Zwraca false, jesli pliku nie ma albo nie da sie go zmapowac (rowniez gdy jest pusty)
+		bool open(const std::string& path)
+		{
+			close();
+#ifdef _WIN32
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			{
+				close();
+				return false;
+			}
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping == NULL)
+			{
+				close();
+				return false;
+			}
+			bytes = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (bytes == NULL)
+			{
+				close();
+				return false;
+			}
+			length = static_cast<size_t>(fileSize.QuadPart);
+#else
+			descriptor = ::open(path.c_str(), O_RDONLY);
+			if (descriptor < 0)
+				return false;
+			struct stat info;
+			if (fstat(descriptor, &info) != 0 || info.st_size == 0)
+			{
+				close();
+				return false;
+			}
+			void* mapped = mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+			if (mapped == MAP_FAILED)
+			{
+				close();
+				return false;
+			}
+			bytes = mapped;
+			length = static_cast<size_t>(info.st_size);
+#endif
+			return true;
+		}
+
+		void close()
+		{
+#ifdef _WIN32
+			if (bytes)
+				UnmapViewOfFile(bytes);
+			if (mapping != NULL)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+			mapping = NULL;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (bytes)
+				munmap(bytes, length);
+			if (descriptor >= 0)
+				::close(descriptor);
+			descriptor = -1;
+#endif
+			bytes = nullptr;
+			length = 0;
+		}
+
+		const unsigned char* data() const { return static_cast<const unsigned char*>(bytes); }
+		size_t size() const { return length; }
+		bool isOpen() const { return bytes != nullptr; }
+
+	private:
+		void* bytes = nullptr;
+		size_t length = 0;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+#else
+		int descriptor = -1;
+#endif
+	};
+
+	// Skrot FNV-1a 64, uzywany jako klucz plikow cache zbudowanych z pliku zrodlowego
+	inline uint64_t HashBytes(const unsigned char* data, size_t size)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= data[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	// Tworzy katalog (jeden poziom), jesli go jeszcze nie ma
+	inline void MakeDirectory(const std::string& directory)
+	{
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+	}
+
+	// Nazwy zwyklych plikow w katalogu (bez podkatalogow); pusta lista, jesli katalogu nie ma.
+	// directory moze byc pusty (katalog roboczy) albo konczyc sie ukosnikiem.
+	inline std::vector<std::string> ListFiles(const std::string& directory)
+	{
+		std::vector<std::string> names;
+#ifdef _WIN32
+		WIN32_FIND_DATAA entry;
+		HANDLE find = FindFirstFileA((directory + "*").c_str(), &entry);
+		if (find == INVALID_HANDLE_VALUE)
+			return names;
+		do
+		{
+			if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				names.push_back(entry.cFileName);
+		} while (FindNextFileA(find, &entry));
+		FindClose(find);
+#else
+		DIR* dir = opendir(directory.empty() ? "." : directory.c_str());
+		if (dir == NULL)
+			return names;
+		while (struct dirent* entry = readdir(dir))
+		{
+			struct stat info;
+			if (stat((directory + entry->d_name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+				names.push_back(entry->d_name);
+		}
+		closedir(dir);
+#endif
+		return names;
+	}
+}
@@ -0,0 +1,170 @@
+#include "Mesh_Cache.h"
+#include "Mapped_File.h"
+#include "profiling/StartupReport.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    bool EndsWith(const std::string& text, const char* suffix)
+    {
+        size_t length = std::strlen(suffix);
+        return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+    }
+
+    const uint32_t MESH_CACHE_MAGIC = 0x48534d47; // "GMSH"
+    // bump whenever BuildMeshBuffers, objload or the assimp import flags produce different buffers
+    const uint32_t MESH_CACHE_VERSION = 3;
+
+    struct MeshCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t sourceHash;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t lodCount;
+        float boundingRadius;
+    };
+}
+
+bool Core::MapMeshCache(const std::string& cachePath, uint64_t sourceHash, MeshCacheView& view)
+{
+    MappedFile& file = view.file;
+    if (!file.open(cachePath) || file.size() < sizeof(MeshCacheHeader))
+        return false;
+
+    MeshCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION || header.sourceHash != sourceHash)
+    {
+        file.close();
+        return false;
+    }
+
+    size_t lodBytes = sizeof(MeshLod) * header.lodCount;
+    size_t vertexBytes = sizeof(float) * MeshBuffers::FLOATS_PER_VERTEX * header.vertexCount;
+    size_t indexBytes = sizeof(unsigned int) * header.indexCount;
+    if (header.lodCount == 0 || file.size() != sizeof(header) + lodBytes + vertexBytes + indexBytes)
+    {
+        std::cout << "mesh cache " << cachePath << " is truncated, rebuilding\n";
+        file.close();
+        return false;
+    }
+
+    // the sections are 4-byte aligned in the file and the mapping is page aligned
+    const unsigned char* lods = file.data() + sizeof(header);
+    const unsigned char* vertices = lods + lodBytes;
+    const unsigned char* indices = vertices + vertexBytes;
+    view.lods = reinterpret_cast<const MeshLod*>(lods);
+    view.vertexData = reinterpret_cast<const float*>(vertices);
+    view.indices = reinterpret_cast<const unsigned int*>(indices);
+    view.vertexCount = header.vertexCount;
+    view.indexCount = header.indexCount;
+    view.lodCount = header.lodCount;
+    view.boundingRadius = header.boundingRadius;
+    return true;
+}
+
+bool Core::LoadMeshData(const std::string& path, MeshData& mesh)
+{
+    uint64_t sourceHash = 0;
+    std::string cachePath = path + ".meshcache";
+    MappedFile source(path);
+    {
+        STARTUP_PHASE("Mesh cache read");
+        if (source.isOpen())
+            sourceHash = HashBytes(source.data(), source.size());
+        if (MapMeshCache(cachePath, sourceHash, mesh.cached))
+        {
+            mesh.fromCache = true;
+            return true;
+        }
+    }
+
+    STARTUP_PHASE("Mesh import");
+    // OBJ files go through objload straight from the mapping; assimp is kept for the other
+    // formats and for meshes too large for objload's 16-bit indices
+    if (source.isOpen() && (EndsWith(path, ".obj") || EndsWith(path, ".objj")))
+    {
+        obj::Model model = obj::loadModelFromBuffer(reinterpret_cast<const char*>(source.data()), source.size());
+        if (!model.vertex.empty() && model.vertex.size() / 3 <= 65536)
+        {
+            BuildMeshBuffers(path, model, mesh.built);
+            mesh.fromCache = false;
+            WriteMeshCache(cachePath, sourceHash, mesh.built);
+            return true;
+        }
+    }
+
+    Assimp::Importer import;
+    const aiScene* scene = import.ReadFile(path,
+        aiProcess_Triangulate |
+        aiProcess_CalcTangentSpace |
+        aiProcess_JoinIdenticalVertices |
+        aiProcess_GenSmoothNormals |
+        aiProcess_RemoveRedundantMaterials |
+        aiProcess_OptimizeMeshes);
+
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+    {
+        std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+        return false;
+    }
+    BuildMeshBuffers(scene->mMeshes[0], mesh.built);
+    mesh.fromCache = false;
+    WriteMeshCache(cachePath, sourceHash, mesh.built);
+    return true;
+}
+
+void Core::UploadMeshData(const MeshData& mesh, RenderContext& context)
+{
+    if (mesh.fromCache)
+    {
+        const MeshCacheView& view = mesh.cached;
+        context.initFromData(view.vertexData, view.vertexCount, view.indices, view.indexCount, view.lods, view.lodCount, view.boundingRadius);
+    }
+    else
+    {
+        context.initFromBuffers(mesh.built);
+    }
+}
+
+bool Core::WriteMeshCache(const std::string& cachePath, uint64_t sourceHash, const MeshBuffers& buffers)
+{
+    MeshCacheHeader header;
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.vertexCount = buffers.vertexCount;
+    header.indexCount = static_cast<uint32_t>(buffers.indices.size());
+    header.lodCount = static_cast<uint32_t>(buffers.lods.size());
+    header.boundingRadius = buffers.boundingRadius;
+
+    // written under a temporary name so a crash never leaves a half-written cache behind
+    std::string temporaryPath = cachePath + ".tmp";
+    {
+        std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cout << "cannot write mesh cache " << cachePath << "\n";
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(buffers.lods.data()), sizeof(MeshLod) * buffers.lods.size());
+        out.write(reinterpret_cast<const char*>(buffers.vertexData.data()), sizeof(float) * buffers.vertexData.size());
+        out.write(reinterpret_cast<const char*>(buffers.indices.data()), sizeof(unsigned int) * buffers.indices.size());
+        if (!out)
+        {
+            std::cout << "cannot write mesh cache " << cachePath << "\n";
+            out.close();
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    std::remove(cachePath.c_str());
+    return std::rename(temporaryPath.c_str(), cachePath.c_str()) == 0;
+}
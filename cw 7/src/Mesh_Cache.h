@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Render_Utils.h"
+#include "Mapped_File.h"
+
+#include <cstdint>
+#include <string>
+
+namespace Core
+{
+	// Plik cache siatki zmapowany w pamieci; wskazniki pokazuja do wnetrza mapowania
+	struct MeshCacheView
+	{
+		MappedFile file;
+		const float* vertexData = nullptr;
+		const unsigned int* indices = nullptr;
+		const MeshLod* lods = nullptr;
+		int vertexCount = 0;
+		size_t indexCount = 0;
+		int lodCount = 0;
+		float boundingRadius = 0.0f;
+	};
+
+	// Mapuje plik cache bez wysylania go na GPU (bez OpenGL, mozna wolac z dowolnego watku).
+	// Zwraca false, jesli pliku nie ma, ma inna wersje lub powstal z innego pliku zrodlowego.
+	bool MapMeshCache(const std::string& cachePath, uint64_t sourceHash, MeshCacheView& view);
+
+	// Zapisuje bufory siatki razem z kluczem pliku zrodlowego
+	bool WriteMeshCache(const std::string& cachePath, uint64_t sourceHash, const MeshBuffers& buffers);
+
+	// Siatka przygotowana bez OpenGL: zmapowany cache albo bufory zbudowane z importu assimpa
+	struct MeshData
+	{
+		MeshCacheView cached;
+		MeshBuffers built;
+		bool fromCache = false;
+	};
+
+	// Czyta cache "<path>.meshcache" albo importuje model i zapisuje cache. Nie wywoluje OpenGL.
+	bool LoadMeshData(const std::string& path, MeshData& mesh);
+
+	// Wysyla siatke na GPU, wymaga kontekstu GL
+	void UploadMeshData(const MeshData& mesh, RenderContext& context);
+}
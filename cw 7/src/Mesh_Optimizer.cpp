@@ -0,0 +1,351 @@
+#include "Mesh_Optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    // Forsyth, "Linear-Speed Vertex Cache Optimisation"
+    const int FORSYTH_CACHE_SIZE = 32;
+    const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+    const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+    const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+    const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+    float forsythVertexScore(int cachePosition, unsigned int liveTriangles)
+    {
+        if (liveTriangles == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3)
+                score = FORSYTH_LAST_TRIANGLE_SCORE;
+            else
+            {
+                float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = std::pow(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+            }
+        }
+        score += FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(liveTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+        return score;
+    }
+
+    // twice the signed area normal of the triangle
+    glm::vec3 triangleNormal(const std::vector<glm::vec3>& positions, const unsigned int* tri)
+    {
+        return glm::cross(positions[tri[1]] - positions[tri[0]], positions[tri[2]] - positions[tri[0]]);
+    }
+}
+
+void Core::OptimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    // triangles of every vertex; the live ones are kept at the front of each range
+    std::vector<unsigned int> liveTriangles(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; i++)
+        liveTriangles[indices[i]]++;
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + liveTriangles[v];
+    std::vector<unsigned int> adjacency(indexCount);
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        vertexScore[v] = forsythVertexScore(-1, liveTriangles[v]);
+
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<char> emitted(triangleCount, 0);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+    std::vector<unsigned int> result;
+    result.reserve(indexCount);
+    std::vector<unsigned int> cache, nextCache;
+    size_t scanStart = 0;
+    long long bestTriangle = -1;
+
+    for (size_t step = 0; step < triangleCount; step++)
+    {
+        if (bestTriangle < 0)
+        {
+            // nothing useful in the cache: take the best remaining triangle
+            while (scanStart < triangleCount && emitted[scanStart])
+                scanStart++;
+            float bestScore = -1.0f;
+            for (size_t t = scanStart; t < triangleCount; t++)
+            {
+                if (!emitted[t] && triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    bestTriangle = static_cast<long long>(t);
+                }
+            }
+        }
+
+        unsigned int t = static_cast<unsigned int>(bestTriangle);
+        const unsigned int tri[3] = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+        emitted[t] = 1;
+        result.insert(result.end(), tri, tri + 3);
+
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = tri[k];
+            unsigned int* begin = &adjacency[offsets[v]];
+            unsigned int* end = begin + liveTriangles[v];
+            unsigned int* found = std::find(begin, end, t);
+            if (found != end)
+            {
+                std::swap(*found, *(end - 1));
+                liveTriangles[v]--;
+            }
+        }
+
+        nextCache.assign(tri, tri + 3);
+        for (unsigned int v : cache)
+        {
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                nextCache.push_back(v);
+        }
+
+        for (size_t i = 0; i < nextCache.size(); i++)
+        {
+            unsigned int v = nextCache[i];
+            cachePosition[v] = i < static_cast<size_t>(FORSYTH_CACHE_SIZE) ? static_cast<int>(i) : -1;
+            vertexScore[v] = forsythVertexScore(cachePosition[v], liveTriangles[v]);
+        }
+
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : nextCache)
+        {
+            for (unsigned int i = 0; i < liveTriangles[v]; i++)
+            {
+                unsigned int other = adjacency[offsets[v] + i];
+                const unsigned int* o = &indices[other * 3];
+                triangleScore[other] = vertexScore[o[0]] + vertexScore[o[1]] + vertexScore[o[2]];
+                if (triangleScore[other] > bestScore)
+                {
+                    bestScore = triangleScore[other];
+                    bestTriangle = other;
+                }
+            }
+        }
+
+        if (nextCache.size() > static_cast<size_t>(FORSYTH_CACHE_SIZE))
+            nextCache.resize(FORSYTH_CACHE_SIZE);
+        cache.swap(nextCache);
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+void Core::OptimizeOverdraw(unsigned int* indices, size_t indexCount, const std::vector<glm::vec3>& positions)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Cluster boundaries go where the cache-optimised order restarts anyway (all three vertices
+    // miss a small FIFO cache), so reordering the clusters costs little cache efficiency.
+    const int cacheSize = 16;
+    std::vector<unsigned int> cacheTime(positions.size(), 0);
+    unsigned int time = cacheSize + 1;
+    std::vector<size_t> clusterStarts;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        int misses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = indices[t * 3 + k];
+            if (time - cacheTime[v] > static_cast<unsigned int>(cacheSize))
+            {
+                cacheTime[v] = time++;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == 3)
+            clusterStarts.push_back(t);
+    }
+    clusterStarts.push_back(triangleCount);
+
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const unsigned int* tri = &indices[t * 3];
+        float area = glm::length(triangleNormal(positions, tri));
+        meshCentroid += (positions[tri[0]] + positions[tri[1]] + positions[tri[2]]) * (area / 3.0f);
+        meshArea += area;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // clusters facing away from the centre are likely to occlude the others, so they go first
+    size_t clusterCount = clusterStarts.size() - 1;
+    std::vector<float> sortKey(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+        {
+            const unsigned int* tri = &indices[t * 3];
+            glm::vec3 n = triangleNormal(positions, tri);
+            float a = glm::length(n);
+            centroid += (positions[tri[0]] + positions[tri[1]] + positions[tri[2]]) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        if (area > 0.0f)
+            centroid /= area;
+        float normalLength = glm::length(normal);
+        sortKey[c] = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+    }
+
+    std::vector<size_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+    std::vector<unsigned int> result;
+    result.reserve(indexCount);
+    for (size_t c : order)
+        result.insert(result.end(), indices + clusterStarts[c] * 3, indices + clusterStarts[c + 1] * 3);
+
+    // the heuristic assumes a roughly convex, closed mesh; keep the cache order where it does not pay off
+    if (AnalyzeOverdraw(&result[0], indexCount, positions) < AnalyzeOverdraw(indices, indexCount, positions))
+        std::copy(result.begin(), result.end(), indices);
+}
+
+std::vector<unsigned int> Core::OptimizeVertexFetch(std::vector<unsigned int>& indices, size_t vertexCount)
+{
+    const unsigned int unassigned = std::numeric_limits<unsigned int>::max();
+    std::vector<unsigned int> remap(vertexCount, unassigned);
+    unsigned int next = 0;
+    for (unsigned int& index : indices)
+    {
+        if (remap[index] == unassigned)
+            remap[index] = next++;
+        index = remap[index];
+    }
+    for (unsigned int& target : remap)
+    {
+        if (target == unassigned)
+            target = next++;
+    }
+    return remap;
+}
+
+Core::VertexCacheStats Core::AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, int cacheSize)
+{
+    std::vector<unsigned int> cacheTime(vertexCount, 0);
+    std::vector<char> used(vertexCount, 0);
+    unsigned int time = cacheSize + 1;
+    size_t misses = 0, usedVertices = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        unsigned int v = indices[i];
+        if (time - cacheTime[v] > static_cast<unsigned int>(cacheSize))
+        {
+            cacheTime[v] = time++;
+            misses++;
+        }
+        if (!used[v])
+        {
+            used[v] = 1;
+            usedVertices++;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = indexCount ? static_cast<float>(misses) / (indexCount / 3) : 0.0f;
+    stats.atvr = usedVertices ? static_cast<float>(misses) / usedVertices : 0.0f;
+    return stats;
+}
+
+float Core::AnalyzeOverdraw(const unsigned int* indices, size_t indexCount, const std::vector<glm::vec3>& positions)
+{
+    const int resolution = 256;
+    if (indexCount == 0)
+        return 0.0f;
+
+    glm::vec3 minimum(std::numeric_limits<float>::max()), maximum(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        minimum = glm::min(minimum, positions[indices[i]]);
+        maximum = glm::max(maximum, positions[indices[i]]);
+    }
+    glm::vec3 extent = glm::max(maximum - minimum, glm::vec3(1e-6f));
+    float scale = (resolution - 1) / std::max(extent.x, std::max(extent.y, extent.z));
+
+    size_t shaded = 0, covered = 0;
+    std::vector<float> depthBuffer(resolution * resolution);
+
+    // orthographic views along +-x, +-y, +-z, with a depth test in submission order
+    for (int view = 0; view < 6; view++)
+    {
+        int axis = view / 2;
+        float direction = (view % 2) ? -1.0f : 1.0f;
+        int uAxis = (axis + 1) % 3, vAxis = (axis + 2) % 3;
+        std::fill(depthBuffer.begin(), depthBuffer.end(), std::numeric_limits<float>::max());
+
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            glm::vec3 p[3];
+            for (int k = 0; k < 3; k++)
+            {
+                glm::vec3 local = (positions[indices[i + k]] - minimum) * scale;
+                p[k] = glm::vec3(local[uAxis], local[vAxis], local[axis] * direction);
+            }
+
+            float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+            if (std::abs(area) < 1e-12f)
+                continue;
+
+            int x0 = std::max(0, static_cast<int>(std::floor(std::min(p[0].x, std::min(p[1].x, p[2].x)))));
+            int x1 = std::min(resolution - 1, static_cast<int>(std::ceil(std::max(p[0].x, std::max(p[1].x, p[2].x)))));
+            int y0 = std::max(0, static_cast<int>(std::floor(std::min(p[0].y, std::min(p[1].y, p[2].y)))));
+            int y1 = std::min(resolution - 1, static_cast<int>(std::ceil(std::max(p[0].y, std::max(p[1].y, p[2].y)))));
+
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    float px = x + 0.5f, py = y + 0.5f;
+                    float w0 = ((p[2].x - p[1].x) * (py - p[1].y) - (p[2].y - p[1].y) * (px - p[1].x)) / area;
+                    float w1 = ((p[0].x - p[2].x) * (py - p[2].y) - (p[0].y - p[2].y) * (px - p[2].x)) / area;
+                    float w2 = 1.0f - w0 - w1;
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                        continue;
+
+                    float depth = w0 * p[0].z + w1 * p[1].z + w2 * p[2].z;
+                    float& stored = depthBuffer[y * resolution + x];
+                    if (depth < stored)
+                    {
+                        stored = depth;
+                        shaded++;
+                    }
+                }
+            }
+        }
+
+        for (float depth : depthBuffer)
+        {
+            if (depth != std::numeric_limits<float>::max())
+                covered++;
+        }
+    }
+
+    return covered ? static_cast<float>(shaded) / covered : 0.0f;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "glm.hpp"
+
+#include <vector>
+
+namespace Core
+{
+	// Zmienia kolejnosc trojkatow tak, aby jak najczesciej trafiac w cache wierzcholkow GPU (algorytm Forsytha)
+	// indices - indeksy trojkatow, zmieniane w miejscu
+	void OptimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount);
+
+	// Dzieli kolejnosc z OptimizeVertexCache na klastry i rysuje najpierw te skierowane na zewnatrz siatki,
+	// zeby mniej fragmentow bylo cieniowanych i potem zaslanianych (podejscie Tipsify)
+	void OptimizeOverdraw(unsigned int* indices, size_t indexCount, const std::vector<glm::vec3>& positions);
+
+	// Numeruje wierzcholki w kolejnosci pierwszego uzycia w indices i przepisuje indeksy.
+	// Zwraca tablice remap[stary indeks] = nowy indeks; wierzcholki nieuzywane trafiaja na koniec.
+	std::vector<unsigned int> OptimizeVertexFetch(std::vector<unsigned int>& indices, size_t vertexCount);
+
+	// Przestawia dane wierzcholkow wg tablicy z OptimizeVertexFetch
+	template <typename T>
+	std::vector<T> RemapVertices(const std::vector<T>& vertices, const std::vector<unsigned int>& remap)
+	{
+		std::vector<T> result(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+			result[remap[i]] = vertices[i];
+		return result;
+	}
+
+	struct VertexCacheStats
+	{
+		// chybienia cache na trojkat (0.5 - 3)
+		float acmr;
+		// chybienia cache na uzyty wierzcholek (1 = optimum)
+		float atvr;
+	};
+
+	// Symuluje cache FIFO o rozmiarze cacheSize
+	VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, int cacheSize = 16);
+
+	// Rasteryzuje siatke programowo z kilku kierunkow i zwraca srednia liczbe cieniowanych fragmentow na pokryty piksel
+	float AnalyzeOverdraw(const unsigned int* indices, size_t indexCount, const std::vector<glm::vec3>& positions);
+}
@@ -0,0 +1,255 @@
+#include "Mesh_Simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
+#include <tuple>
+#include <utility>
+
+namespace
+{
+    // symmetric 4x4 matrix of the plane quadric, upper triangle only
+    struct Quadric
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        double a11 = 0, a12 = 0, a13 = 0;
+        double a22 = 0, a23 = 0;
+        double a33 = 0;
+    };
+
+    void addPlane(Quadric& q, const glm::dvec3& n, double d)
+    {
+        q.a00 += n.x * n.x; q.a01 += n.x * n.y; q.a02 += n.x * n.z; q.a03 += n.x * d;
+        q.a11 += n.y * n.y; q.a12 += n.y * n.z; q.a13 += n.y * d;
+        q.a22 += n.z * n.z; q.a23 += n.z * d;
+        q.a33 += d * d;
+    }
+
+    void addQuadric(Quadric& q, const Quadric& other)
+    {
+        q.a00 += other.a00; q.a01 += other.a01; q.a02 += other.a02; q.a03 += other.a03;
+        q.a11 += other.a11; q.a12 += other.a12; q.a13 += other.a13;
+        q.a22 += other.a22; q.a23 += other.a23;
+        q.a33 += other.a33;
+    }
+
+    // sum of squared distances of p to the planes accumulated in q
+    double evaluate(const Quadric& q, const glm::dvec3& p)
+    {
+        return q.a00 * p.x * p.x + 2 * q.a01 * p.x * p.y + 2 * q.a02 * p.x * p.z + 2 * q.a03 * p.x
+            + q.a11 * p.y * p.y + 2 * q.a12 * p.y * p.z + 2 * q.a13 * p.y
+            + q.a22 * p.z * p.z + 2 * q.a23 * p.z
+            + q.a33;
+    }
+
+    struct Collapse
+    {
+        unsigned int from;
+        unsigned int to;
+        double cost;
+    };
+
+    glm::dvec3 triangleNormal(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+    {
+        return glm::cross(glm::dvec3(p1) - glm::dvec3(p0), glm::dvec3(p2) - glm::dvec3(p0));
+    }
+}
+
+std::vector<unsigned int> Core::SimplifyMesh(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices,
+    size_t targetIndexCount, float* resultError)
+{
+    size_t vertexCount = positions.size();
+    std::vector<unsigned int> result(indices);
+
+    // vertices that share a position sit on an attribute seam; collapsing them would tear the mesh
+    std::vector<unsigned int> positionRemap(vertexCount);
+    std::vector<bool> lockedPosition(vertexCount, false);
+    std::map<std::tuple<float, float, float>, unsigned int> firstAtPosition;
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        auto inserted = firstAtPosition.emplace(std::make_tuple(positions[i].x, positions[i].y, positions[i].z), i);
+        positionRemap[i] = inserted.first->second;
+        if (!inserted.second)
+            lockedPosition[inserted.first->second] = true;
+    }
+
+    // edges used by a single triangle lie on an open border
+    std::map<std::pair<unsigned int, unsigned int>, int> edgeUse;
+    for (size_t i = 0; i < result.size(); i += 3)
+    {
+        for (int e = 0; e < 3; e++)
+        {
+            unsigned int a = positionRemap[result[i + e]];
+            unsigned int b = positionRemap[result[i + (e + 1) % 3]];
+            edgeUse[std::make_pair(std::min(a, b), std::max(a, b))]++;
+        }
+    }
+    for (const auto& edge : edgeUse)
+    {
+        if (edge.second == 1)
+        {
+            lockedPosition[edge.first.first] = true;
+            lockedPosition[edge.first.second] = true;
+        }
+    }
+
+    std::vector<bool> locked(vertexCount);
+    for (unsigned int i = 0; i < vertexCount; i++)
+        locked[i] = lockedPosition[positionRemap[i]];
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < result.size(); i += 3)
+    {
+        const glm::vec3& p0 = positions[result[i]];
+        glm::dvec3 normal = triangleNormal(p0, positions[result[i + 1]], positions[result[i + 2]]);
+        double length = glm::length(normal);
+        if (length == 0.0)
+            continue;
+        normal /= length;
+        double d = -glm::dot(normal, glm::dvec3(p0));
+        for (int k = 0; k < 3; k++)
+            addPlane(quadrics[result[i + k]], normal, d);
+    }
+
+    double maxError = 0.0;
+    std::vector<unsigned int> collapseTarget(vertexCount);
+    std::vector<char> touched(vertexCount);
+    std::vector<unsigned int> triangleOffsets(vertexCount + 1);
+    std::vector<unsigned int> vertexTriangles;
+    std::vector<Collapse> candidates;
+
+    // Each pass collapses the cheapest edges that do not share a triangle with another collapse
+    // of the same pass, then rewrites the index buffer.
+    while (result.size() > targetIndexCount)
+    {
+        size_t triangleCount = result.size() / 3;
+
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+        for (unsigned int index : result)
+            triangleOffsets[index + 1]++;
+        for (size_t i = 0; i < vertexCount; i++)
+            triangleOffsets[i + 1] += triangleOffsets[i];
+        vertexTriangles.resize(result.size());
+        std::vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                vertexTriangles[fill[result[t * 3 + k]]++] = static_cast<unsigned int>(t);
+
+        candidates.clear();
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (int e = 0; e < 3; e++)
+            {
+                unsigned int a = result[t * 3 + e];
+                unsigned int b = result[t * 3 + (e + 1) % 3];
+                Quadric sum = quadrics[a];
+                addQuadric(sum, quadrics[b]);
+                if (!locked[a])
+                    candidates.push_back({ a, b, evaluate(sum, glm::dvec3(positions[b])) });
+                if (!locked[b])
+                    candidates.push_back({ b, a, evaluate(sum, glm::dvec3(positions[a])) });
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Collapse& x, const Collapse& y) {
+            return x.cost < y.cost || (x.cost == y.cost && (x.from < y.from || (x.from == y.from && x.to < y.to)));
+        });
+
+        std::iota(collapseTarget.begin(), collapseTarget.end(), 0);
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+        size_t removed = 0;
+
+        for (const Collapse& collapse : candidates)
+        {
+            if (removed >= trianglesToRemove)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            // reject collapses that would flip a surviving triangle around the removed vertex
+            bool valid = true;
+            size_t shared = 0;
+            for (unsigned int i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1] && valid; i++)
+            {
+                const unsigned int* tri = &result[vertexTriangles[i] * 3];
+                if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+                {
+                    shared++;
+                    continue;
+                }
+
+                glm::vec3 before[3], after[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    before[k] = positions[tri[k]];
+                    after[k] = positions[tri[k] == collapse.from ? collapse.to : tri[k]];
+                }
+                glm::dvec3 normalBefore = triangleNormal(before[0], before[1], before[2]);
+                glm::dvec3 normalAfter = triangleNormal(after[0], after[1], after[2]);
+                if (glm::dot(normalBefore, normalAfter) <= 0.0)
+                    valid = false;
+            }
+            if (!valid || shared == 0)
+                continue;
+
+            collapseTarget[collapse.from] = collapse.to;
+            for (unsigned int i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1]; i++)
+            {
+                const unsigned int* tri = &result[vertexTriangles[i] * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+            }
+            addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+            maxError = std::max(maxError, collapse.cost);
+            removed += shared;
+        }
+
+        if (removed == 0)
+            break;
+
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            unsigned int a = collapseTarget[result[i]];
+            unsigned int b = collapseTarget[result[i + 1]];
+            unsigned int c = collapseTarget[result[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+    }
+
+    if (resultError)
+        *resultError = static_cast<float>(std::sqrt(maxError));
+    return result;
+}
+
+std::vector<Core::MeshLod> Core::BuildLodChain(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices,
+    int maxLevels, std::vector<unsigned int>& lodIndices)
+{
+    std::vector<MeshLod> lods;
+    lodIndices = indices;
+    lods.push_back({ 0, static_cast<int>(indices.size()), 0.0f });
+
+    std::vector<unsigned int> current = indices;
+    float error = 0.0f;
+    for (int level = 1; level < maxLevels; level++)
+    {
+        size_t target = current.size() / 2 / 3 * 3;
+        float levelError = 0.0f;
+        std::vector<unsigned int> simplified = SimplifyMesh(positions, current, target, &levelError);
+        // locked borders and seams stop the simplifier; a level that barely shrinks is not worth a draw
+        if (simplified.empty() || simplified.size() > current.size() * 9 / 10)
+            break;
+
+        // each level is simplified from the previous one, so the deviations add up
+        error += levelError;
+        lods.push_back({ static_cast<unsigned int>(lodIndices.size()), static_cast<int>(simplified.size()), error });
+        lodIndices.insert(lodIndices.end(), simplified.begin(), simplified.end());
+        current.swap(simplified);
+    }
+    return lods;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "glm.hpp"
+
+#include <vector>
+
+namespace Core
+{
+	// Upraszcza siatke trojkatow przez sciaganie krawedzi wg bledu kwadryk (Garland-Heckbert).
+	// Wierzcholki nie sa przesuwane ani tworzone - zwracane sa nowe indeksy do tego samego bufora,
+	// wiec kolejne poziomy LOD moga dzielic jeden bufor wierzcholkow. Wierzcholki na brzegach siatki
+	// i na szwach UV/normalnych (kilka wierzcholkow w tej samej pozycji) sa zablokowane.
+	// positions - pozycje wszystkich wierzcholkow
+	// indices - indeksy trojkatow
+	// targetIndexCount - docelowa liczba indeksow (moze nie zostac osiagnieta)
+	// resultError - jesli nie NULL, otrzymuje przyblizone najwieksze odchylenie od oryginalu w jednostkach modelu
+	std::vector<unsigned int> SimplifyMesh(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices,
+		size_t targetIndexCount, float* resultError);
+
+	struct MeshLod
+	{
+		unsigned int firstIndex;
+		int count;
+		// odchylenie od pelnej siatki w jednostkach modelu
+		float error;
+	};
+
+	// Buduje lancuch maxLevels poziomow (poziom 0 to oryginal), kazdy o polowe mniejszy od poprzedniego.
+	// Indeksy wszystkich poziomow sa dopisywane kolejno do lodIndices.
+	std::vector<MeshLod> BuildLodChain(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices,
+		int maxLevels, std::vector<unsigned int>& lodIndices);
+}
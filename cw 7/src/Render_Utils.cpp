@@ -1,6 +1,8 @@
 #include "Render_Utils.h"
+#include "Mesh_Optimizer.h"
 
 #include <algorithm>
+#include <cmath>
 
 #include "glew.h"
 #include "freeglut.h"
@@ -10,25 +12,114 @@
 
 
 
-void Core::RenderContext::initFromAssimpMesh(aiMesh* mesh) {
-    vertexArray = 0;
-    vertexBuffer = 0;
-    vertexIndexBuffer = 0;
+namespace
+{
+    // Shared part of both BuildMeshBuffers: LOD chain, triangle and vertex order, interleaving
+    void buildFromAttributes(const std::string& name, std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals,
+        std::vector<glm::vec2>& textureCoord, std::vector<glm::vec3>& tangents, std::vector<glm::vec3>& bitangents,
+        const std::vector<unsigned int>& indices, Core::MeshBuffers& buffers)
+    {
+        buffers.boundingRadius = 0.0f;
+        for (const glm::vec3& position : positions)
+            buffers.boundingRadius = std::max(buffers.boundingRadius, glm::length(position));
 
-    std::vector<float> textureCoord;
-    std::vector<unsigned int> indices;
-    //tex coord must be converted to 2d vecs
-    for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        // all LOD levels share the vertex buffer and follow each other in the index buffer
+        std::vector<unsigned int>& lodIndices = buffers.indices;
+        std::vector<Core::MeshLod>& lods = buffers.lods;
+        lods = Core::BuildLodChain(positions, indices, 4, lodIndices);
+
+        Core::VertexCacheStats cacheBefore = Core::AnalyzeVertexCache(&lodIndices[0], lods[0].count, positions.size());
+        float overdrawBefore = Core::AnalyzeOverdraw(&lodIndices[0], lods[0].count, positions);
+
+        // the cache order is not better on every mesh (the overlapping leaf cards of the tree shade more
+        // fragments in it than in the authored order), so each LOD keeps the optimised order only when
+        // neither ACMR nor overdraw gets worse; the 0.1% margin absorbs rasterisation noise on overdraw
+        for (const Core::MeshLod& lod : lods)
+        {
+            unsigned int* lodBegin = &lodIndices[lod.firstIndex];
+            std::vector<unsigned int> original(lodBegin, lodBegin + lod.count);
+            Core::OptimizeVertexCache(lodBegin, lod.count, positions.size());
+            Core::OptimizeOverdraw(lodBegin, lod.count, positions);
+            if (Core::AnalyzeOverdraw(lodBegin, lod.count, positions) > Core::AnalyzeOverdraw(&original[0], lod.count, positions) * 1.001f
+                || Core::AnalyzeVertexCache(lodBegin, lod.count, positions.size()).acmr > Core::AnalyzeVertexCache(&original[0], lod.count, positions.size()).acmr)
+                std::copy(original.begin(), original.end(), lodBegin);
+        }
+        std::vector<unsigned int> remap = Core::OptimizeVertexFetch(lodIndices, positions.size());
+        positions = Core::RemapVertices(positions, remap);
+        normals = Core::RemapVertices(normals, remap);
+        textureCoord = Core::RemapVertices(textureCoord, remap);
+        tangents = Core::RemapVertices(tangents, remap);
+        bitangents = Core::RemapVertices(bitangents, remap);
+
+        Core::VertexCacheStats cacheAfter = Core::AnalyzeVertexCache(&lodIndices[0], lods[0].count, positions.size());
+        float overdrawAfter = Core::AnalyzeOverdraw(&lodIndices[0], lods[0].count, positions);
+        std::cout << "mesh " << name << ": " << positions.size() << " vertices, " << lods.size() << " lods"
+            << ", ACMR " << cacheBefore.acmr << " -> " << cacheAfter.acmr
+            << ", ATVR " << cacheBefore.atvr << " -> " << cacheAfter.atvr
+            << ", overdraw " << overdrawBefore << " -> " << overdrawAfter << "\n";
+
+        buffers.vertexCount = (int)positions.size();
+        buffers.vertexData.resize(positions.size() * Core::MeshBuffers::FLOATS_PER_VERTEX);
+        float* vertex = buffers.vertexData.data();
+        for (size_t i = 0; i < positions.size(); i++)
+        {
+            *vertex++ = positions[i].x; *vertex++ = positions[i].y; *vertex++ = positions[i].z;
+            *vertex++ = normals[i].x; *vertex++ = normals[i].y; *vertex++ = normals[i].z;
+            *vertex++ = textureCoord[i].x; *vertex++ = textureCoord[i].y;
+            *vertex++ = tangents[i].x; *vertex++ = tangents[i].y; *vertex++ = tangents[i].z;
+            *vertex++ = bitangents[i].x; *vertex++ = bitangents[i].y; *vertex++ = bitangents[i].z;
+        }
+    }
+
+    // Per-vertex tangent frame from the uv layout of the triangles around it, as aiProcess_CalcTangentSpace
+    // builds it: face tangents are accumulated, then made orthogonal to the normal. Vertices without
+    // a usable uv gradient get any tangent perpendicular to the normal.
+    void computeTangents(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+        const std::vector<glm::vec2>& textureCoord, const std::vector<unsigned int>& indices,
+        std::vector<glm::vec3>& tangents, std::vector<glm::vec3>& bitangents)
     {
-        if (mesh->mTextureCoords[0] != nullptr) {
-            textureCoord.push_back(mesh->mTextureCoords[0][i].x);
-            textureCoord.push_back(mesh->mTextureCoords[0][i].y);
+        tangents.assign(positions.size(), glm::vec3(0.0f));
+        bitangents.assign(positions.size(), glm::vec3(0.0f));
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            glm::vec3 edge1 = positions[b] - positions[a], edge2 = positions[c] - positions[a];
+            glm::vec2 uv1 = textureCoord[b] - textureCoord[a], uv2 = textureCoord[c] - textureCoord[a];
+            float determinant = uv1.x * uv2.y - uv2.x * uv1.y;
+            if (std::abs(determinant) < 1e-12f)
+                continue;
+            // unnormalised, so larger triangles weigh more
+            glm::vec3 tangent = (edge1 * uv2.y - edge2 * uv1.y) / determinant;
+            glm::vec3 bitangent = (edge2 * uv1.x - edge1 * uv2.x) / determinant;
+            for (unsigned int v : { a, b, c })
+            {
+                tangents[v] += tangent;
+                bitangents[v] += bitangent;
+            }
         }
-        else {
-            textureCoord.push_back(0.0f);
-            textureCoord.push_back(0.0f);
+
+        for (size_t v = 0; v < positions.size(); v++)
+        {
+            const glm::vec3& normal = normals[v];
+            glm::vec3 tangent = tangents[v] - normal * glm::dot(normal, tangents[v]);
+            if (glm::dot(tangent, tangent) < 1e-12f)
+            {
+                glm::vec3 axis = std::abs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+                tangent = glm::cross(normal, axis);
+            }
+            tangent = glm::normalize(tangent);
+            // the bitangent keeps the handedness of the uv mapping
+            glm::vec3 bitangent = glm::cross(normal, tangent);
+            if (glm::dot(bitangent, bitangents[v]) < 0.0f)
+                bitangent = -bitangent;
+            tangents[v] = tangent;
+            bitangents[v] = bitangent;
         }
     }
+}
+
+void Core::BuildMeshBuffers(aiMesh* mesh, MeshBuffers& buffers) {
+    std::vector<unsigned int> indices;
     if (mesh->mTextureCoords[0] == nullptr) {
         std::cout << "no uv coords\n";
     }
@@ -40,50 +131,204 @@ void Core::RenderContext::initFromAssimpMesh(aiMesh* mesh) {
             indices.push_back(face.mIndices[j]);
     }
 
-    unsigned int vertexDataBufferSize = sizeof(float) * mesh->mNumVertices * 3;
-    unsigned int vertexNormalBufferSize = sizeof(float) * mesh->mNumVertices * 3;
-    unsigned int vertexTexBufferSize = sizeof(float) * mesh->mNumVertices * 2;
-    unsigned int vertexTangentBufferSize = sizeof(float) * mesh->mNumVertices * 3;
-    unsigned int vertexBiTangentBufferSize = sizeof(float) * mesh->mNumVertices * 3;
+    // attributes are copied out of assimp so they can be reordered; missing ones become zeros
+    std::vector<glm::vec3> positions(mesh->mNumVertices), normals(mesh->mNumVertices), tangents(mesh->mNumVertices), bitangents(mesh->mNumVertices);
+    //tex coord must be converted to 2d vecs
+    std::vector<glm::vec2> textureCoord(mesh->mNumVertices);
+    for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+    {
+        positions[i] = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+        if (mesh->mNormals != nullptr)
+            normals[i] = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+        if (mesh->mTextureCoords[0] != nullptr)
+            textureCoord[i] = glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
+        if (mesh->mTangents != nullptr)
+            tangents[i] = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+        if (mesh->mBitangents != nullptr)
+            bitangents[i] = glm::vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+    }
 
-    unsigned int vertexElementBufferSize = sizeof(unsigned int) * indices.size();
-    size = indices.size();
+    buildFromAttributes(mesh->mName.C_Str(), positions, normals, textureCoord, tangents, bitangents, indices, buffers);
+}
 
-    glGenVertexArrays(1, &vertexArray);
-    glBindVertexArray(vertexArray);
+void Core::BuildMeshBuffers(const std::string& name, const obj::Model& model, MeshBuffers& buffers) {
+    // objload puts every face into the "default" group as well
+    std::map<std::string, std::vector<unsigned short> >::const_iterator faces = model.faces.find("default");
+    std::vector<unsigned int> indices;
+    if (faces != model.faces.end())
+        indices.assign(faces->second.begin(), faces->second.end());
+
+    size_t vertexCount = model.vertex.size() / 3;
+    std::vector<glm::vec3> positions(vertexCount), normals(vertexCount, glm::vec3(0.0f)), tangents, bitangents;
+    std::vector<glm::vec2> textureCoord(vertexCount, glm::vec2(0.0f));
+    for (size_t i = 0; i < vertexCount; i++)
+        positions[i] = glm::vec3(model.vertex[3 * i], model.vertex[3 * i + 1], model.vertex[3 * i + 2]);
+    if (model.texCoord.empty())
+        std::cout << "no uv coords\n";
+    else
+        for (size_t i = 0; i < vertexCount; i++)
+            textureCoord[i] = glm::vec2(model.texCoord[2 * i], model.texCoord[2 * i + 1]);
+
+    if (!model.normal.empty())
+    {
+        for (size_t i = 0; i < vertexCount; i++)
+            normals[i] = glm::vec3(model.normal[3 * i], model.normal[3 * i + 1], model.normal[3 * i + 2]);
+    }
+    else
+    {
+        // smooth normals weighted by triangle area, like aiProcess_GenSmoothNormals
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            const glm::vec3& a = positions[indices[i]];
+            glm::vec3 faceNormal = glm::cross(positions[indices[i + 1]] - a, positions[indices[i + 2]] - a);
+            for (size_t k = 0; k < 3; k++)
+                normals[indices[i + k]] += faceNormal;
+        }
+        for (glm::vec3& normal : normals)
+            if (glm::dot(normal, normal) > 0.0f)
+                normal = glm::normalize(normal);
+    }
 
+    computeTangents(positions, normals, textureCoord, indices, tangents, bitangents);
+    buildFromAttributes(name, positions, normals, textureCoord, tangents, bitangents, indices, buffers);
+}
 
-    glGenBuffers(1, &vertexIndexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vertexIndexBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, vertexElementBufferSize, &indices[0], GL_STATIC_DRAW);
+void Core::RenderContext::initFromAssimpMesh(aiMesh* mesh) {
+    MeshBuffers buffers;
+    BuildMeshBuffers(mesh, buffers);
+    initFromBuffers(buffers);
+}
 
-    glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    //std::cout << vertexBuffer;
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
+void Core::RenderContext::initFromBuffers(const MeshBuffers& buffers) {
+    initFromData(&buffers.vertexData[0], buffers.vertexCount, &buffers.indices[0], buffers.indices.size(),
+        &buffers.lods[0], (int)buffers.lods.size(), buffers.boundingRadius);
+}
 
-    glBufferData(GL_ARRAY_BUFFER, vertexDataBufferSize + vertexNormalBufferSize + vertexTexBufferSize + vertexTangentBufferSize + vertexBiTangentBufferSize, NULL, GL_STATIC_DRAW);
+void Core::RenderContext::initFromData(const float* vertexData, int vertexCount, const unsigned int* indices, size_t indexCount,
+    const MeshLod* lodLevels, int lodCount, float boundingRadius) {
+    this->vertexCount = vertexCount;
+    this->boundingRadius = boundingRadius;
+    GetMeshPool().append(vertexData, vertexCount, indices, indexCount, baseVertex, firstIndex);
 
-    glBufferSubData(GL_ARRAY_BUFFER, 0, vertexDataBufferSize, mesh->mVertices);
+    // LOD ranges are shifted to the indices of the pool
+    lods.assign(lodLevels, lodLevels + lodCount);
+    for (MeshLod& lod : lods)
+        lod.firstIndex += firstIndex;
+    size = lods[0].count;
+}
 
-    glBufferSubData(GL_ARRAY_BUFFER, vertexDataBufferSize, vertexNormalBufferSize, mesh->mNormals);
+void Core::RenderContext::bindVertexAttributes() const
+{
+    GetMeshPool().bindVertexAttributes();
+}
 
-    glBufferSubData(GL_ARRAY_BUFFER, vertexDataBufferSize + vertexNormalBufferSize, vertexTexBufferSize, &textureCoord[0]);
+Core::MeshPool& Core::GetMeshPool()
+{
+    static MeshPool pool;
+    return pool;
+}
 
-    glBufferSubData(GL_ARRAY_BUFFER, vertexDataBufferSize + vertexNormalBufferSize + vertexTexBufferSize, vertexTangentBufferSize, mesh->mTangents);
+void Core::MeshPool::reserve(int vertexCapacity, size_t indexCapacity)
+{
+    if (vertexArray == 0)
+    {
+        glGenVertexArrays(1, &vertexArray);
+        glGenBuffers(1, &vertexBuffer);
+        glGenBuffers(1, &indexBuffer);
+    }
+    if (vertexCapacity > this->vertexCapacity)
+    {
+        vertexBuffer = resize(vertexBuffer, (size_t)usedVertices * VERTEX_STRIDE, (size_t)vertexCapacity * VERTEX_STRIDE);
+        this->vertexCapacity = vertexCapacity;
+        bufferGeneration++;
+    }
+    if (indexCapacity > this->indexCapacity)
+    {
+        indexBuffer = resize(indexBuffer, usedIndices * sizeof(unsigned int), indexCapacity * sizeof(unsigned int));
+        this->indexCapacity = indexCapacity;
+        bufferGeneration++;
+    }
 
-    glBufferSubData(GL_ARRAY_BUFFER, vertexDataBufferSize + vertexNormalBufferSize + vertexTexBufferSize + vertexTangentBufferSize, vertexBiTangentBufferSize, mesh->mBitangents);
+    glBindVertexArray(vertexArray);
+    bindVertexAttributes();
+    glBindVertexArray(0);
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)(0));
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(vertexDataBufferSize));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)(vertexNormalBufferSize + vertexDataBufferSize));
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)(vertexDataBufferSize + vertexNormalBufferSize + vertexTexBufferSize));
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, (void*)(vertexDataBufferSize + vertexNormalBufferSize + vertexTexBufferSize + vertexTangentBufferSize));
+void Core::MeshPool::append(const float* vertexData, int vertexCount, const unsigned int* indices, size_t indexCount,
+    int& baseVertex, unsigned int& firstIndex)
+{
+    // buffers grow twofold, so adding a mesh does not copy the whole pool every time
+    int neededVertices = usedVertices + vertexCount;
+    size_t neededIndices = usedIndices + indexCount;
+    if (vertexArray == 0 || neededVertices > vertexCapacity || neededIndices > indexCapacity)
+        reserve(std::max(neededVertices, vertexCapacity * 2), std::max(neededIndices, indexCapacity * 2));
+
+    baseVertex = usedVertices;
+    firstIndex = (unsigned int)usedIndices;
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, (size_t)usedVertices * VERTEX_STRIDE, (size_t)vertexCount * VERTEX_STRIDE, vertexData);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // GL_ELEMENT_ARRAY_BUFFER is VAO state, so the index buffer is filled through GL_COPY_WRITE_BUFFER
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, usedIndices * sizeof(unsigned int), indexCount * sizeof(unsigned int), indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
+    usedVertices = neededVertices;
+    usedIndices = neededIndices;
+}
+
+void Core::MeshPool::bindVertexAttributes() const
+{
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    for (int i = 0; i < 5; i++)
+        glEnableVertexAttribArray(i);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VERTEX_STRIDE, (void*)(0));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, VERTEX_STRIDE, (void*)(sizeof(float) * 3));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, VERTEX_STRIDE, (void*)(sizeof(float) * 6));
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, VERTEX_STRIDE, (void*)(sizeof(float) * 8));
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, VERTEX_STRIDE, (void*)(sizeof(float) * 11));
+}
+
+void Core::MeshPool::destroy()
+{
+    glDeleteVertexArrays(1, &vertexArray);
+    glDeleteBuffers(1, &vertexBuffer);
+    glDeleteBuffers(1, &indexBuffer);
+    vertexArray = vertexBuffer = indexBuffer = 0;
+    vertexCapacity = usedVertices = 0;
+    indexCapacity = usedIndices = 0;
+}
+
+// Creates a larger buffer and copies the used part of the old one into it on the GPU
+GLuint Core::MeshPool::resize(GLuint buffer, size_t usedBytes, size_t capacityBytes)
+{
+    GLuint resized;
+    glGenBuffers(1, &resized);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacityBytes, NULL, GL_STATIC_DRAW);
+    if (usedBytes > 0)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    return resized;
+}
+
+int Core::RenderContext::selectLod(float pixelsPerModelUnit, float maxPixelError) const
+{
+    int lod = 0;
+    for (int i = 1; i < (int)lods.size(); i++)
+    {
+        if (lods[i].error * pixelsPerModelUnit > maxPixelError)
+            break;
+        lod = i;
+    }
+    return lod;
 }
 
 void Core::DrawVertexArray(const float * vertexArray, int numVertices, int elementSize )
@@ -116,13 +361,11 @@ void Core::DrawVertexArray( const VertexData & data )
 
 void Core::DrawContext(Core::RenderContext& context)
 {
-
-	glBindVertexArray(context.vertexArray);
-	glDrawElements(
+	glDrawElementsBaseVertex(
 		GL_TRIANGLES,      // mode
 		context.size,    // count
 		GL_UNSIGNED_INT,   // type
-		(void*)0           // element array buffer offset
+		(void*)(sizeof(unsigned int) * context.firstIndex),  // element array buffer offset
+		context.baseVertex
 	);
-	glBindVertexArray(0);
 }
@@ -5,21 +5,105 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <vector>
+
+#include "Mesh_Simplifier.h"
 
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 namespace Core
 {
+	// Dane siatki w postaci gotowej do wyslania na GPU
+	struct MeshBuffers
+	{
+		// pozycja, normalna, uv, tangent, bitangent
+		static const int FLOATS_PER_VERTEX = 3 + 3 + 2 + 3 + 3;
+
+		int vertexCount = 0;
+		float boundingRadius = 0.0f;
+		// wierzcholki z przeplatanymi atrybutami: pozycja, normalna, uv, tangent, bitangent (uklad z MeshPool)
+		std::vector<float> vertexData;
+		// indeksy wszystkich poziomow LOD
+		std::vector<unsigned int> indices;
+		std::vector<MeshLod> lods;
+	};
+
+	// Buduje LOD-y i optymalizuje kolejnosc trojkatow i wierzcholkow siatki z assimpa
+	void BuildMeshBuffers(aiMesh* mesh, MeshBuffers& buffers);
+	// To samo dla modelu z objload; brakujace normalne i tangenty sa liczone tutaj
+	void BuildMeshBuffers(const std::string& name, const obj::Model& model, MeshBuffers& buffers);
+
+	// Jeden bufor wierzcholkow i jeden bufor indeksow wspolne dla wszystkich statycznych siatek,
+	// z jednym VAO. Siatka zajmuje w nich zakres opisany przez baseVertex i firstIndex, wiec
+	// rysowanie kolejnych siatek nie wymaga zmiany VAO (glDrawElementsBaseVertex).
+	class MeshPool
+	{
+	public:
+		static const GLsizei VERTEX_STRIDE = sizeof(float) * MeshBuffers::FLOATS_PER_VERTEX;
+
+		GLuint vertexArray = 0;
+		GLuint vertexBuffer = 0;
+		GLuint indexBuffer = 0;
+
+		// Rezerwuje miejsce z gory. Powiekszenie zastepuje bufory nowymi i zwieksza generation(),
+		// wiec VAO utworzone poza pula trzeba wtedy zbudowac od nowa
+		void reserve(int vertexCapacity, size_t indexCapacity);
+
+		// Dopisuje siatke na koniec buforow i zwraca jej przesuniecia
+		void append(const float* vertexData, int vertexCount, const unsigned int* indices, size_t indexCount,
+			int& baseVertex, unsigned int& firstIndex);
+
+		// Ustawia atrybuty 0-4 i bufor indeksow puli w aktualnie zbindowanym VAO
+		void bindVertexAttributes() const;
+
+		void destroy();
+
+		int vertexCount() const { return usedVertices; }
+		size_t indexCount() const { return usedIndices; }
+		// zmienia sie przy kazdej wymianie vertexBuffer albo indexBuffer
+		unsigned int generation() const { return bufferGeneration; }
+
+	private:
+		unsigned int bufferGeneration = 0;
+		int vertexCapacity = 0;
+		size_t indexCapacity = 0;
+		int usedVertices = 0;
+		size_t usedIndices = 0;
+
+		static GLuint resize(GLuint buffer, size_t usedBytes, size_t capacityBytes);
+	};
+
+	// Pula, do ktorej trafiaja wszystkie siatki z RenderContext::initFromData
+	MeshPool& GetMeshPool();
+
 	struct RenderContext
     {
-		GLuint vertexArray;
-		GLuint vertexBuffer;
-		GLuint vertexIndexBuffer;
+		// przesuniecie pierwszego wierzcholka i pierwszego indeksu siatki w MeshPool
+		int baseVertex = 0;
+		unsigned int firstIndex = 0;
 		int size = 0;
+		int vertexCount = 0;
+		float boundingRadius = 0.0f;
+		// poziomy szczegolowosci jako zakresy bufora indeksow puli, lods[0] to pelna siatka (size indeksow od firstIndex)
+		std::vector<MeshLod> lods;
 
         void initFromOBJ(obj::Model& model);
 
 		void initFromAssimpMesh(aiMesh* mesh);
+
+		void initFromBuffers(const MeshBuffers& buffers);
+
+		// Dopisuje gotowe bufory do MeshPool; dane moga pochodzic np. z zmapowanego pliku cache
+		void initFromData(const float* vertexData, int vertexCount, const unsigned int* indices, size_t indexCount,
+			const MeshLod* lodLevels, int lodCount, float boundingRadius);
+
+		// Ustawia atrybuty 0-4 (pozycja, normalna, uv, tangent, bitangent) oraz bufor indeksow w aktualnie zbindowanym VAO.
+		// Atrybuty pokazuja na poczatek puli, przy rysowaniu trzeba podac baseVertex.
+		void bindVertexAttributes() const;
+
+		// Wybiera najprostszy poziom LOD, ktorego blad po rzutowaniu nie przekracza maxPixelError pikseli
+		// pixelsPerModelUnit - ile pikseli ekranu zajmuje jednostka modelu w odleglosci obiektu
+		int selectLod(float pixelsPerModelUnit, float maxPixelError = 1.0f) const;
 	};
 
 	// vertexArray - jednowymiarowa tablica zawierajaca wartosci opisujace pozycje kolejnych wierzcholkow w jednym ciagu (x1, y1, z1, w1, x2, y2, z2, w2, ...)
@@ -68,5 +152,6 @@ namespace Core
 	*/
 	void DrawVertexArray(const VertexData & data);
 
+	// Rysuje siatke z MeshPool; VAO puli (GetMeshPool().vertexArray) musi byc zbindowane - wystarczy raz na przebieg
 	void DrawContext(RenderContext& context);
 }
\ No newline at end of file
@@ -2,6 +2,10 @@
 #include<iostream>
 #include<fstream>
 #include<vector>
+#include<cstdio>
+
+#include "Mapped_File.h"
+#include "profiling/StartupReport.h"
 
 using namespace Core;
 
@@ -60,43 +64,214 @@ GLuint Shader_Loader::CreateShader(GLenum shaderType, std::string
 GLuint Shader_Loader::CreateProgram(char* vertexShaderFilename,
 	char* fragmentShaderFilename)
 {
+	return CreateProgram(vertexShaderFilename, NULL, fragmentShaderFilename);
+}
 
+GLuint Shader_Loader::CreateProgram(char* vertexShaderFilename,
+	char* geometryShaderFilename,
+	char* fragmentShaderFilename)
+{
+	STARTUP_PHASE("Shader sources");
 	//wczytaj shadery
-	std::string vertex_shader_code = ReadShader(vertexShaderFilename);
-	std::string fragment_shader_code = ReadShader(fragmentShaderFilename);
+	ProgramSource source;
+	source.vertex = ReadShader(vertexShaderFilename);
+	source.fragment = ReadShader(fragmentShaderFilename);
+	if (geometryShaderFilename != NULL)
+		source.geometry = ReadShader(geometryShaderFilename);
 
-	GLuint vertex_shader = CreateShader(GL_VERTEX_SHADER, vertex_shader_code, "vertex shader");
-	GLuint fragment_shader = CreateShader(GL_FRAGMENT_SHADER, fragment_shader_code, "fragment shader");
+	std::string allSources = source.vertex + '\0' + source.geometry + '\0' + source.fragment;
+	uint64_t sourceHash = HashBytes(reinterpret_cast<const unsigned char*>(allSources.data()), allSources.size());
+
+	//ten sam program byl juz utworzony
+	std::map<uint64_t, GLuint>::iterator existing = programsBySource.find(sourceHash);
+	if (existing != programsBySource.end())
+	{
+		programs[existing->second].references++;
+		return existing->second;
+	}
+
+	std::string directory = vertexShaderFilename;
+	size_t slash = directory.find_last_of("/\\");
+	directory = slash == std::string::npos ? "" : directory.substr(0, slash + 1);
+	char hashName[32];
+	snprintf(hashName, sizeof(hashName), "%016llx", (unsigned long long)sourceHash);
+	source.cachePath = directory + hashName + ".progbin";
 
-	int link_result = 0;
-	//stworz shader
 	GLuint program = glCreateProgram();
+	pending[program] = source;
+	programs[program] = { sourceHash, 1 };
+	programsBySource[sourceHash] = program;
+	return program;
+}
+
+void Shader_Loader::PrepareProgram(GLuint program)
+{
+	std::map<GLuint, ProgramSource>::iterator entry = pending.find(program);
+	if (entry == pending.end())
+		return;
+
+	STARTUP_PHASE("Shader link");
+	uint64_t sourceHash = programs[program].sourceHash;
+	if (!LoadBinary(program, entry->second, sourceHash) && LinkFromSource(program, entry->second))
+		SaveBinary(program, entry->second, sourceHash);
+	pending.erase(entry);
+}
+
+bool Shader_Loader::LinkFromSource(GLuint program, const ProgramSource& source)
+{
+	GLuint vertex_shader = CreateShader(GL_VERTEX_SHADER, source.vertex, "vertex shader");
+	GLuint fragment_shader = CreateShader(GL_FRAGMENT_SHADER, source.fragment, "fragment shader");
+	GLuint geometry_shader = 0;
+	if (!source.geometry.empty())
+		geometry_shader = CreateShader(GL_GEOMETRY_SHADER, source.geometry, "geometry shader");
+
+	int link_result = 0;
 	glAttachShader(program, vertex_shader);
+	if (geometry_shader != 0)
+		glAttachShader(program, geometry_shader);
 	glAttachShader(program, fragment_shader);
 
+	if (GLEW_ARB_get_program_binary)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(program);
 	glGetProgramiv(program, GL_LINK_STATUS, &link_result);
+
+	glDetachShader(program, vertex_shader);
+	glDetachShader(program, fragment_shader);
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+	if (geometry_shader != 0)
+	{
+		glDetachShader(program, geometry_shader);
+		glDeleteShader(geometry_shader);
+	}
+
 	//sprawdz bledy w linkerze
 	if (link_result == GL_FALSE)
 	{
 
 		int info_log_length = 0;
 		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_log_length);
-		std::vector<char> program_log(info_log_length);
+		std::vector<char> program_log(info_log_length + 1);
 		glGetProgramInfoLog(program, info_log_length, NULL, &program_log[0]);
 		std::cout << "Shader Loader : LINK ERROR" << std::endl << &program_log[0] << std::endl;
-		return 0;
+		return false;
 	}
+	return true;
+}
 
-	glDetachShader(program, vertex_shader);
-	glDetachShader(program, fragment_shader);
-	glDeleteShader(vertex_shader);
-	glDeleteShader(fragment_shader);
+namespace
+{
+	const uint32_t PROGRAM_BINARY_MAGIC = 0x47525047; // "GPRG"
+	const uint32_t PROGRAM_BINARY_VERSION = 1;
 
-	return program;
+	struct ProgramBinaryHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint64_t driverHash;
+		uint32_t format;
+		uint32_t size;
+	};
+
+	uint64_t currentDriverHash()
+	{
+		std::string driver;
+		const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (GLenum name : names)
+		{
+			const char* value = reinterpret_cast<const char*>(glGetString(name));
+			driver += value ? value : "";
+			driver += '\n';
+		}
+		return HashBytes(reinterpret_cast<const unsigned char*>(driver.data()), driver.size());
+	}
+
+	bool binariesSupported()
+	{
+		if (!GLEW_ARB_get_program_binary)
+			return false;
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}
+}
+
+bool Shader_Loader::LoadBinary(GLuint program, const ProgramSource& source, uint64_t sourceHash)
+{
+	if (!binariesSupported())
+		return false;
+	if (driverHash == 0)
+		driverHash = currentDriverHash();
+
+	MappedFile file(source.cachePath);
+	if (!file.isOpen() || file.size() < sizeof(ProgramBinaryHeader))
+		return false;
+	const ProgramBinaryHeader* header = reinterpret_cast<const ProgramBinaryHeader*>(file.data());
+	if (header->magic != PROGRAM_BINARY_MAGIC || header->version != PROGRAM_BINARY_VERSION
+		|| header->sourceHash != sourceHash || header->driverHash != driverHash
+		|| file.size() != sizeof(ProgramBinaryHeader) + header->size)
+		return false;
+
+	//sterownik moze odrzucic binarke (np. po aktualizacji), wtedy program jest linkowany ze zrodel
+	int link_result = 0;
+	glProgramBinary(program, header->format, file.data() + sizeof(ProgramBinaryHeader), header->size);
+	glGetProgramiv(program, GL_LINK_STATUS, &link_result);
+	return link_result == GL_TRUE;
+}
+
+void Shader_Loader::SaveBinary(GLuint program, const ProgramSource& source, uint64_t sourceHash)
+{
+	if (!binariesSupported())
+		return;
+	if (driverHash == 0)
+		driverHash = currentDriverHash();
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	ProgramBinaryHeader header;
+	header.magic = PROGRAM_BINARY_MAGIC;
+	header.version = PROGRAM_BINARY_VERSION;
+	header.sourceHash = sourceHash;
+	header.driverHash = driverHash;
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, &binary[0]);
+	header.format = format;
+	header.size = (uint32_t)length;
+
+	std::string temporaryPath = source.cachePath + ".tmp";
+	{
+		std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(&binary[0], length);
+		if (!out)
+		{
+			out.close();
+			std::remove(temporaryPath.c_str());
+			return;
+		}
+	}
+	std::remove(source.cachePath.c_str());
+	std::rename(temporaryPath.c_str(), source.cachePath.c_str());
 }
 
 void Shader_Loader::DeleteProgram( GLuint program )
 {
+	std::map<GLuint, Program>::iterator entry = programs.find(program);
+	if (entry != programs.end())
+	{
+		//program moze byc wspoldzielony przez kilka wywolan CreateProgram
+		if (--entry->second.references > 0)
+			return;
+		programsBySource.erase(entry->second.sourceHash);
+		programs.erase(entry);
+		pending.erase(program);
+	}
 	glDeleteProgram(program);
 }
@@ -2,7 +2,10 @@
 
 #include "glew.h"
 #include "freeglut.h"
+#include <cstdint>
 #include <iostream>
+#include <map>
+#include <string>
 
 namespace Core
 {
@@ -11,19 +14,53 @@ namespace Core
 	{
 	private:
 
+		// program utworzony przez CreateProgram, ale jeszcze nie zlinkowany
+		struct ProgramSource
+		{
+			std::string cachePath;
+			std::string vertex;
+			std::string geometry;
+			std::string fragment;
+		};
+
+		struct Program
+		{
+			uint64_t sourceHash;
+			int references;
+		};
+
+		std::map<GLuint, ProgramSource> pending;
+		std::map<GLuint, Program> programs;
+		std::map<uint64_t, GLuint> programsBySource;
+		uint64_t driverHash = 0;
+
 		std::string ReadShader(char *filename);
 		GLuint CreateShader(GLenum shaderType,
 			std::string source,
 			char* shaderName);
+		bool LinkFromSource(GLuint program, const ProgramSource& source);
+		bool LoadBinary(GLuint program, const ProgramSource& source, uint64_t sourceHash);
+		void SaveBinary(GLuint program, const ProgramSource& source, uint64_t sourceHash);
 
 	public:
 
 		Shader_Loader(void);
 		~Shader_Loader(void);
+
+		// Programy o identycznych zrodlach sa tworzone tylko raz. Zwracany identyfikator jest od razu
+		// wazny, ale program jest linkowany dopiero w PrepareProgram - z binarki zapisanej obok shaderow
+		// ("<hash zrodel>.progbin", waznej dla tego samego sterownika) albo ze zrodel.
 		GLuint CreateProgram(char* VertexShaderFilename,
 			char* FragmentShaderFilename);
+		GLuint CreateProgram(char* VertexShaderFilename,
+			char* GeometryShaderFilename,
+			char* FragmentShaderFilename);
+
+		// Wywolywane przed pierwszym uzyciem programu (glUseProgram, glGetUniformLocation);
+		// kolejne wywolania nic nie robia
+		void PrepareProgram(GLuint program);
 
 		void DeleteProgram(GLuint program);
 
 	};
-}
\ No newline at end of file
+}
@@ -1,35 +1,528 @@
 #include "Texture.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <fstream> 
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <string>
 #include <vector>
 #include "SOIL/SOIL.h"
+#include "SOIL/image_helper.h"
+extern "C" {
+#include "SOIL/image_DXT.h"
+}
+#include "Mapped_File.h"
+#include "profiling/StartupReport.h"
 
 typedef unsigned char byte;
 
-GLuint Core::LoadTexture( const char * filepath )
+namespace
 {
-	GLuint id;
-	glGenTextures(1, &id);
-	glBindTexture(GL_TEXTURE_2D, id);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// Cached images are DDS files next to the source ("rocky.jpg.dds") holding a DXT1/DXT5 mip chain,
+	// or an RGTC2 (BC5) chain of the x and y components for normal maps.
+	// The reserved header words mark our own files and tie them to the source contents.
+	const unsigned int TEXTURE_CACHE_TAG = ('G' << 0) | ('R' << 8) | ('K' << 16) | ('C' << 24);
+	const unsigned int TEXTURE_CACHE_VERSION = 1;
+	const unsigned int FOURCC_DXT1 = ('D' << 0) | ('X' << 8) | ('T' << 16) | ('1' << 24);
+	const unsigned int FOURCC_DXT5 = ('D' << 0) | ('X' << 8) | ('T' << 16) | ('5' << 24);
+	const unsigned int FOURCC_ATI2 = ('A' << 0) | ('T' << 8) | ('I' << 16) | ('2' << 24);
+
+	// One BC4 block (8 bytes) from 16 values of one channel: the block's minimum and maximum as
+	// endpoints with six values between them, each texel taking the nearest of the eight
+	void encodeBC4Block(const unsigned char values[16], unsigned char* out)
+	{
+		int low = 255, high = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			low = std::min(low, (int)values[i]);
+			high = std::max(high, (int)values[i]);
+		}
+		// high > low selects the eight-value mode; on a flat block every index is 0 (= high)
+		out[0] = (unsigned char)high;
+		out[1] = (unsigned char)low;
+		uint64_t bits = 0;
+		if (high > low)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				// step 0..7 from high towards low; the endpoints are indices 0 and 1, the steps between 2..7
+				int step = ((high - values[i]) * 14 + (high - low)) / (2 * (high - low));
+				uint64_t index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+				bits |= index << (3 * i);
+			}
+		}
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = (unsigned char)(bits >> (8 * i));
+	}
+
+	// RGTC2: a BC4 block of the red channel followed by one of the green channel per 4x4 texels
+	std::vector<unsigned char> compressRGTC2(const unsigned char* rgba, int width, int height)
+	{
+		std::vector<unsigned char> out;
+		out.reserve(size_t(std::max(1, (width + 3) / 4)) * std::max(1, (height + 3) / 4) * 16);
+		for (int by = 0; by < height; by += 4)
+		{
+			for (int bx = 0; bx < width; bx += 4)
+			{
+				unsigned char red[16], green[16];
+				for (int i = 0; i < 16; i++)
+				{
+					// levels smaller than a block repeat their edge texels
+					int x = std::min(bx + i % 4, width - 1), y = std::min(by + i / 4, height - 1);
+					const unsigned char* texel = rgba + (size_t(y) * width + x) * 4;
+					red[i] = texel[0];
+					green[i] = texel[1];
+				}
+				unsigned char block[16];
+				encodeBC4Block(red, block);
+				encodeBC4Block(green, block + 8);
+				out.insert(out.end(), block, block + 16);
+			}
+		}
+		return out;
+	}
+
+	size_t compressedLevelSize(GLenum format, int width, int height)
+	{
+		size_t blockSize = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+		return std::max(1, (width + 3) / 4) * std::max(1, (height + 3) / 4) * blockSize;
+	}
+
+	bool writeCompressedImage(const char* filepath, const std::string& cachePath, uint64_t sourceHash, bool normalMap)
+	{
+		int width, height;
+		unsigned char* image = SOIL_load_image(filepath, &width, &height, 0, SOIL_LOAD_RGBA);
+		if (!image)
+			return false;
+
+		bool opaque = true;
+		for (size_t i = 3; i < size_t(width) * height * 4 && opaque; i += 4)
+			opaque = image[i] == 255;
+		GLenum format = normalMap ? GL_COMPRESSED_RG_RGTC2
+			: opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+		std::vector<unsigned char> levelData;
+		std::vector<unsigned char> level(image, image + size_t(width) * height * 4);
+		SOIL_free_image_data(image);
+
+		int levelWidth = width, levelHeight = height, levels = 0;
+		while (true)
+		{
+			if (normalMap)
+			{
+				std::vector<unsigned char> compressed = compressRGTC2(&level[0], levelWidth, levelHeight);
+				levelData.insert(levelData.end(), compressed.begin(), compressed.end());
+			}
+			else
+			{
+				// DXT1 drops the alpha channel; the converters pick it by channel count
+				int compressedSize = 0;
+				unsigned char* compressed = opaque
+					? convert_image_to_DXT1(&level[0], levelWidth, levelHeight, 4, &compressedSize)
+					: convert_image_to_DXT5(&level[0], levelWidth, levelHeight, 4, &compressedSize);
+				if (!compressed)
+					return false;
+				levelData.insert(levelData.end(), compressed, compressed + compressedSize);
+				free(compressed);
+			}
+			levels++;
+
+			if (levelWidth == 1 && levelHeight == 1)
+				break;
+			int nextWidth = std::max(1, levelWidth / 2), nextHeight = std::max(1, levelHeight / 2);
+			std::vector<unsigned char> next(size_t(nextWidth) * nextHeight * 4);
+			mipmap_image(&level[0], levelWidth, levelHeight, 4, &next[0],
+				levelWidth > 1 ? 2 : 1, levelHeight > 1 ? 2 : 1);
+			level.swap(next);
+			levelWidth = nextWidth;
+			levelHeight = nextHeight;
+		}
+
+		DDS_header header;
+		memset(&header, 0, sizeof(header));
+		header.dwMagic = ('D' << 0) | ('D' << 8) | ('S' << 16) | (' ' << 24);
+		header.dwSize = 124;
+		header.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | DDSD_MIPMAPCOUNT;
+		header.dwWidth = width;
+		header.dwHeight = height;
+		header.dwPitchOrLinearSize = (unsigned int)compressedLevelSize(format, width, height);
+		header.dwMipMapCount = levels;
+		header.dwReserved1[0] = TEXTURE_CACHE_TAG;
+		header.dwReserved1[1] = TEXTURE_CACHE_VERSION;
+		header.dwReserved1[2] = (unsigned int)(sourceHash & 0xffffffffu);
+		header.dwReserved1[3] = (unsigned int)(sourceHash >> 32);
+		header.sPixelFormat.dwSize = 32;
+		header.sPixelFormat.dwFlags = DDPF_FOURCC;
+		header.sPixelFormat.dwFourCC = normalMap ? FOURCC_ATI2 : opaque ? FOURCC_DXT1 : FOURCC_DXT5;
+		header.sCaps.dwCaps1 = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+
+		std::string temporaryPath = cachePath + ".tmp";
+		{
+			std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+			out.write((const char*)&header, sizeof(header));
+			out.write((const char*)&levelData[0], levelData.size());
+			if (!out)
+			{
+				std::cerr << "Cannot write texture cache: " << cachePath << std::endl;
+				out.close();
+				std::remove(temporaryPath.c_str());
+				return false;
+			}
+		}
+		std::remove(cachePath.c_str());
+		return std::rename(temporaryPath.c_str(), cachePath.c_str()) == 0;
+	}
+
+	// A cache of the wrong kind (color for a normal map or the other way round) is not used
+	bool mapCompressedImage(const std::string& cachePath, uint64_t sourceHash, bool normalMap, Core::ImageData& image)
+	{
+		if (!image.compressed.open(cachePath) || image.compressed.size() < sizeof(DDS_header))
+			return false;
+
+		DDS_header header;
+		memcpy(&header, image.compressed.data(), sizeof(header));
+		if (header.dwReserved1[0] != TEXTURE_CACHE_TAG || header.dwReserved1[1] != TEXTURE_CACHE_VERSION
+			|| header.dwReserved1[2] != (unsigned int)(sourceHash & 0xffffffffu) || header.dwReserved1[3] != (unsigned int)(sourceHash >> 32))
+			return false;
+		unsigned int fourCC = header.sPixelFormat.dwFourCC;
+		if (normalMap ? fourCC != FOURCC_ATI2 : (fourCC != FOURCC_DXT1 && fourCC != FOURCC_DXT5))
+			return false;
+
+		GLenum format = fourCC == FOURCC_ATI2 ? GL_COMPRESSED_RG_RGTC2
+			: fourCC == FOURCC_DXT1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		int levels = header.dwMipMapCount;
+		size_t expected = sizeof(header);
+		for (int level = 0; level < levels; level++)
+			expected += compressedLevelSize(format, std::max(1, (int)header.dwWidth >> level), std::max(1, (int)header.dwHeight >> level));
+		if (levels == 0 || image.compressed.size() != expected)
+			return false;
+
+		image.format = format;
+		image.width = header.dwWidth;
+		image.height = header.dwHeight;
+		image.levels = levels;
+		return true;
+	}
+
+	bool decodePixels(Core::ImageData& image)
+	{
+		int w, h;
+		unsigned char* data = SOIL_load_image(image.path.c_str(), &w, &h, 0, SOIL_LOAD_RGBA);
+		if (!data)
+			return false;
+		image.width = w;
+		image.height = h;
 
-	int w, h;
-	unsigned char* image = SOIL_load_image(filepath, &w, &h, 0, SOIL_LOAD_RGBA);
-	
+		// The whole mip chain is built here, in the decoding thread, one level after another in
+		// pixels, so the GL thread only copies the levels and never calls glGenerateMipmap
+		size_t total = 0;
+		int levels = 0;
+		for (int lw = w, lh = h; ; lw = std::max(1, lw / 2), lh = std::max(1, lh / 2))
+		{
+			total += size_t(lw) * lh * 4;
+			levels++;
+			if (lw == 1 && lh == 1)
+				break;
+		}
+		image.pixels.resize(total);
+		memcpy(&image.pixels[0], data, size_t(w) * h * 4);
+		SOIL_free_image_data(data);
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
+		unsigned char* level = &image.pixels[0];
+		for (int lw = w, lh = h; lw > 1 || lh > 1; )
+		{
+			unsigned char* next = level + size_t(lw) * lh * 4;
+			mipmap_image(level, lw, lh, 4, next, lw > 1 ? 2 : 1, lh > 1 ? 2 : 1);
+			level = next;
+			lw = std::max(1, lw / 2);
+			lh = std::max(1, lh / 2);
+		}
+		image.levels = levels;
+		return true;
+	}
 
-	return id;
+	const unsigned char* pixelLevelData(const Core::ImageData& image, int level)
+	{
+		const unsigned char* data = &image.pixels[0];
+		for (int i = 0; i < level; i++)
+			data += size_t(std::max(1, image.width >> i)) * std::max(1, image.height >> i) * 4;
+		return data;
+	}
+
+	const unsigned char* compressedLevelData(const Core::ImageData& image, int level)
+	{
+		const unsigned char* data = image.compressed.data() + sizeof(DDS_header);
+		for (int i = 0; i < level; i++)
+			data += compressedLevelSize(image.format, std::max(1, image.width >> i), std::max(1, image.height >> i));
+		return data;
+	}
+
+	// Allocates one level of a 2D texture or cube map face and returns the copy that fills it
+	Core::TextureLevelUpload allocateLevel(GLenum target, const Core::ImageData& image, int level)
+	{
+		int w = std::max(1, image.width >> level), h = std::max(1, image.height >> level);
+		if (!image.isCompressed())
+		{
+			glTexImage2D(target, level, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			return { target, level, 0, w, h, 0, pixelLevelData(image, level), size_t(w) * h * 4 };
+		}
+		size_t size = compressedLevelSize(image.format, w, h);
+		glCompressedTexImage2D(target, level, image.format, w, h, 0, (GLsizei)size, NULL);
+		return { target, level, 0, w, h, image.format, compressedLevelData(image, level), size };
+	}
+
+	// Layers of an array or the faces of a cube map all have to be compressed the same way, otherwise
+	// the whole set goes in uncompressed
+	bool prepareImageSet(Core::ImageData* images, int count)
+	{
+		bool compressed = count > 0;
+		for (int i = 0; i < count; i++)
+		{
+			const Core::ImageData& image = images[i];
+			const Core::ImageData& first = images[0];
+			if (!image.isCompressed() || image.format != first.format || image.width != first.width
+				|| image.height != first.height || image.levels != first.levels)
+				compressed = false;
+		}
+		if (compressed)
+			return true;
+
+		for (int i = 0; i < count; i++)
+		{
+			Core::ImageData& image = images[i];
+			if (image.isCompressed())
+			{
+				image.compressed.close();
+				image.format = 0;
+				if (!decodePixels(image))
+					std::cerr << "Failed to load: " << image.path << std::endl;
+			}
+		}
+		return false;
+	}
 }
 
+bool Core::LoadImageData(const char * filepath, ImageData& image, bool normalMap)
+{
+	STARTUP_PHASE("Image decode");
+	image.path = filepath;
+	if (GLEW_EXT_texture_compression_s3tc)
+	{
+		uint64_t sourceHash = 0;
+		bool sourceFound;
+		{
+			MappedFile source(filepath);
+			sourceFound = source.isOpen();
+			if (sourceFound)
+				sourceHash = HashBytes(source.data(), source.size());
+		}
+
+		std::string cachePath = std::string(filepath) + ".dds";
+		if (sourceFound && (mapCompressedImage(cachePath, sourceHash, normalMap, image)
+			|| (writeCompressedImage(filepath, cachePath, sourceHash, normalMap) && mapCompressedImage(cachePath, sourceHash, normalMap, image))))
+			return true;
+		image.compressed.close();
+		image.format = 0;
+	}
+
+	if (!decodePixels(image))
+	{
+		std::cerr << "Failed to load: " << filepath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+Core::TextureUploadPlan Core::PlanTextureUpload(GLenum bindTarget, ImageData* images, int count)
+{
+	TextureUploadPlan plan;
+	plan.bindTarget = bindTarget;
+	glGenTextures(1, &plan.texture);
+	glBindTexture(bindTarget, plan.texture);
+
+	if (bindTarget == GL_TEXTURE_2D)
+	{
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+		const ImageData& image = images[0];
+		if (!image.isValid())
+			return plan;
+		for (int level = 0; level < image.levels; level++)
+			plan.levels.push_back(allocateLevel(GL_TEXTURE_2D, image, level));
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels - 1);
+		return plan;
+	}
+
+	if (bindTarget == GL_TEXTURE_2D_ARRAY)
+	{
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+		if (prepareImageSet(images, count))
+		{
+			const ImageData& first = images[0];
+			for (int level = 0; level < first.levels; level++)
+			{
+				int w = std::max(1, first.width >> level), h = std::max(1, first.height >> level);
+				size_t layerSize = compressedLevelSize(first.format, w, h);
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.format, w, h, count, 0, (GLsizei)(layerSize * count), NULL);
+				for (int layer = 0; layer < count; layer++)
+					plan.levels.push_back({ GL_TEXTURE_2D_ARRAY, level, layer, w, h, first.format,
+						compressedLevelData(images[layer], level), layerSize });
+			}
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.levels - 1);
+			return plan;
+		}
+
+		const ImageData* first = NULL;
+		for (int layer = 0; layer < count; layer++)
+		{
+			const ImageData& image = images[layer];
+			if (!image.isValid())
+				continue;
+			if (!first)
+			{
+				first = &image;
+				for (int level = 0; level < image.levels; level++)
+					glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA, std::max(1, image.width >> level), std::max(1, image.height >> level),
+						count, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, image.levels - 1);
+			}
+			if (image.width != first->width || image.height != first->height)
+			{
+				std::cerr << "Texture array layer size mismatch: " << image.path << std::endl;
+				continue;
+			}
+			for (int level = 0; level < image.levels; level++)
+			{
+				int w = std::max(1, image.width >> level), h = std::max(1, image.height >> level);
+				plan.levels.push_back({ GL_TEXTURE_2D_ARRAY, level, layer, w, h, 0, pixelLevelData(image, level), size_t(w) * h * 4 });
+			}
+		}
+		return plan;
+	}
 
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	prepareImageSet(images, count);
+	int levels = 0;
+	for (int face = 0; face < count && face < 6; face++)
+	{
+		const ImageData& image = images[face];
+		if (!image.isValid())
+			continue;
+		for (int level = 0; level < image.levels; level++)
+			plan.levels.push_back(allocateLevel(GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)face, image, level));
+		levels = levels == 0 ? image.levels : std::min(levels, image.levels);
+	}
+	if (levels > 0)
+	{
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	}
+	return plan;
+}
+
+void Core::UploadTextureLevel(const TextureLevelUpload& upload, const void* data)
+{
+	if (upload.target == GL_TEXTURE_2D_ARRAY)
+	{
+		if (upload.format)
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, 0, upload.y, upload.layer, upload.width, upload.height, 1,
+				upload.format, (GLsizei)upload.size, data);
+		else
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, 0, upload.y, upload.layer, upload.width, upload.height, 1,
+				GL_RGBA, GL_UNSIGNED_BYTE, data);
+		return;
+	}
+	if (upload.format)
+		glCompressedTexSubImage2D(upload.target, upload.level, 0, upload.y, upload.width, upload.height, upload.format, (GLsizei)upload.size, data);
+	else
+		glTexSubImage2D(upload.target, upload.level, 0, upload.y, upload.width, upload.height, GL_RGBA, GL_UNSIGNED_BYTE, data);
+}
+
+std::vector<Core::TextureLevelUpload> Core::SplitTextureLevel(const TextureLevelUpload& upload, size_t maxBytes)
+{
+	// bloki skompresowane maja 4 wiersze, wiec pas musi zaczynac sie i konczyc na granicy bloku
+	int rowsPerUnit = upload.format ? 4 : 1;
+	int units = (upload.height + rowsPerUnit - 1) / rowsPerUnit;
+	size_t unitBytes = upload.size / units;
+	int unitsPerBand = std::max(1, (int)(maxBytes / unitBytes));
+
+	std::vector<TextureLevelUpload> bands;
+	for (int unit = 0; unit < units; unit += unitsPerBand)
+	{
+		int bandUnits = std::min(unitsPerBand, units - unit);
+		TextureLevelUpload band = upload;
+		band.y = upload.y + unit * rowsPerUnit;
+		band.height = std::min(bandUnits * rowsPerUnit, upload.height - unit * rowsPerUnit);
+		band.data = upload.data + unit * unitBytes;
+		band.size = bandUnits * unitBytes;
+		bands.push_back(band);
+	}
+	return bands;
+}
+
+namespace
+{
+	GLuint createNow(GLenum bindTarget, Core::ImageData* images, int count)
+	{
+		Core::TextureUploadPlan plan = Core::PlanTextureUpload(bindTarget, images, count);
+		for (const Core::TextureLevelUpload& upload : plan.levels)
+			Core::UploadTextureLevel(upload, upload.data);
+		return plan.texture;
+	}
+}
+
+GLuint Core::CreateTexture(ImageData& image)
+{
+	return createNow(GL_TEXTURE_2D, &image, 1);
+}
+
+GLuint Core::CreateTextureArray(std::vector<ImageData>& layers)
+{
+	return createNow(GL_TEXTURE_2D_ARRAY, layers.data(), (int)layers.size());
+}
+
+GLuint Core::CreateCubemap(std::vector<ImageData>& faces)
+{
+	return createNow(GL_TEXTURE_CUBE_MAP, faces.data(), (int)faces.size());
+}
+
+GLuint Core::LoadTexture(const char * filepath)
+{
+	ImageData image;
+	LoadImageData(filepath, image);
+	return CreateTexture(image);
+}
+
+GLuint Core::LoadTextureArray(const char * const * filepaths, int count)
+{
+	std::vector<ImageData> layers(count);
+	for (int layer = 0; layer < count; layer++)
+		LoadImageData(filepaths[layer], layers[layer]);
+	return CreateTextureArray(layers);
+}
+
+GLuint Core::LoadCubemap(const char * const * filepaths)
+{
+	std::vector<ImageData> faces(6);
+	for (int face = 0; face < 6; face++)
+		LoadImageData(filepaths[face], faces[face]);
+	return CreateCubemap(faces);
+}
 
 void Core::SetActiveTexture(GLuint textureID, const char * shaderVariableName, GLuint programID, int textureUnit)
 {
@@ -3,10 +3,89 @@
 #include "glew.h"
 #include "freeglut.h"
 
+#include <string>
+#include <vector>
+
+#include "Mapped_File.h"
+
 namespace Core
 {
+	// Obraz wczytany z dysku bez wywolan OpenGL - mozna go przygotowac w watku roboczym,
+	// a na GPU wyslac pozniej funkcjami Create* w watku z kontekstem GL
+	struct ImageData
+	{
+		std::string path;
+		// zmapowany cache DXT (gdy format != 0)
+		MappedFile compressed;
+		GLenum format = 0;
+		int width = 0;
+		int height = 0;
+		// liczba poziomow mipmap, w cache DXT albo w pixels
+		int levels = 0;
+		// zdekodowane piksele RGBA, gdy cache nie jest dostepny - kolejne poziomy mipmap jeden za drugim
+		std::vector<unsigned char> pixels;
+
+		bool isCompressed() const { return format != 0; }
+		bool isValid() const { return isCompressed() || !pixels.empty(); }
+	};
+
+	// Nie wywoluje OpenGL (poza odczytem flag rozszerzen glew), wiec moze dzialac w dowolnym watku.
+	// normalMap - obraz jest mapa normalnych: cache trzyma tylko x i y (RGTC2/BC5, kanaly r i g),
+	// a shader odtwarza z; DXT1 za bardzo psuje normalne
+	bool LoadImageData(const char * filepath, ImageData& image, bool normalMap = false);
+
+	// Pojedyncza kopia danych do tekstury (jeden poziom mipmapy jednej warstwy albo sciany)
+	struct TextureLevelUpload
+	{
+		// GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY albo sciana GL_TEXTURE_CUBE_MAP_*
+		GLenum target;
+		int level;
+		int layer;
+		int width;
+		int height;
+		// format skompresowany albo 0 dla pikseli RGBA
+		GLenum format;
+		const unsigned char* data;
+		size_t size;
+		// pierwszy wiersz, gdy kopia obejmuje tylko pas poziomu
+		int y = 0;
+	};
+
+	struct TextureUploadPlan
+	{
+		GLuint texture = 0;
+		GLenum bindTarget = GL_TEXTURE_2D;
+		std::vector<TextureLevelUpload> levels;
+	};
+
+	// Tworzy teksture (GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY albo GL_TEXTURE_CUBE_MAP) z zaalokowanymi
+	// poziomami bez danych i zwraca liste kopii do wykonania. Wskazniki w planie wskazuja na dane obrazow,
+	// wiec obrazy musza zyc do konca wgrywania.
+	TextureUploadPlan PlanTextureUpload(GLenum bindTarget, ImageData* images, int count);
+
+	// Tekstura musi byc zbindowana. data - wskaznik na dane albo przesuniecie w zbindowanym GL_PIXEL_UNPACK_BUFFER
+	void UploadTextureLevel(const TextureLevelUpload& upload, const void* data);
+
+	// Dzieli kopie na pasy wierszy (dla formatow skompresowanych pelnych wierszy blokow) po co najwyzej maxBytes
+	std::vector<TextureLevelUpload> SplitTextureLevel(const TextureLevelUpload& upload, size_t maxBytes);
+
+	// Wgrywaja caly plan od razu
+	GLuint CreateTexture(ImageData& image);
+	GLuint CreateTextureArray(std::vector<ImageData>& layers);
+	GLuint CreateCubemap(std::vector<ImageData>& faces);
+
 	GLuint LoadTexture(const char * filepath);
 
+	// Laduje obrazy o jednakowych wymiarach jako kolejne warstwy tekstury GL_TEXTURE_2D_ARRAY
+	GLuint LoadTextureArray(const char * const * filepaths, int count);
+
+	// Laduje 6 scian (+X, -X, +Y, -Y, +Z, -Z) jako GL_TEXTURE_CUBE_MAP
+	GLuint LoadCubemap(const char * const * filepaths);
+
+	// Wszystkie funkcje Load* przy pierwszym uzyciu zapisuja obok pliku zrodlowego cache "<plik>.dds"
+	// (DXT1/DXT5, dla map normalnych RGTC2, z pelnym lancuchem mipmap) i przy kolejnych uruchomieniach wgrywaja go bez dekodowania obrazu.
+	// Bez rozszerzenia GL_EXT_texture_compression_s3tc obrazy sa ladowane nieskompresowane.
+
 	// textureID - identyfikator tekstury otrzymany z funkcji LoadTexture
 	// shaderVariableName - nazwa zmiennej typu 'sampler2D' w shaderze, z ktora ma zostac powiazana tekstura
 	// programID - identyfikator aktualnego programu karty graficznej
@@ -19,24 +19,37 @@
 #include <vector>
 #include <random>
 #include <numeric>
+#include <cstddef>
+#include <algorithm>
+#include <limits>
 
 #include "Terrain.h"
+#include "../rendering/CascadedShadowMap.h"
+#include "../rendering/RenderQueue.h"
+#include "../rendering/ImpostorAtlas.h"
+#include "../profiling/CpuProfiler.h"
+
+// Per-instance data of the instanced boid draws. In the colour pass layer is the
+// gradient texture layer, in the shadow pass it is the target cascade.
+struct BoidInstance {
+	glm::mat4 model;
+	float layer;
+};
 
 class Boid {
 public:
 	glm::vec3 position;
 	glm::vec3 velocity;
 	glm::vec3 scale;
-	Core::RenderContext modelContext;
-	GLuint textureID;
+	int textureLayer;
 	SimulationParams* simulationParams;
 	ProceduralTerrain* terrain;
 
 	static constexpr float MAX_SPEED = 2.0f;
 	static constexpr float MIN_SPEED = 0.2f;
 
-	Boid(glm::vec3 pos, glm::vec3 vel, const Core::RenderContext& context, SimulationParams* simulationPms, ProceduralTerrain* terr, GLuint texID = -1)
-		: position(pos), velocity(vel), simulationParams(simulationPms), modelContext(context), terrain(terr), scale(simulationPms->boidModelScale), textureID(texID) {
+	Boid(glm::vec3 pos, glm::vec3 vel, SimulationParams* simulationPms, ProceduralTerrain* terr, int texLayer = 0)
+		: position(pos), velocity(vel), simulationParams(simulationPms), terrain(terr), scale(simulationPms->boidModelScale), textureLayer(texLayer) {
 	}
 
 	void update(float deltaTime, const glm::vec3& acceleration) {
@@ -53,36 +66,10 @@ public:
 		limitSpeed();
 	}
 
-	void draw(GLuint shaderProgram, GLuint modelLoc, const glm::mat4& view,
-		const glm::mat4& projection, GLuint viewLoc, GLuint projectionLoc, glm::vec3 cameraPos)
-	{
-		glUseProgram(shaderProgram);
-		Core::SetActiveTexture(textureID, "boidTexture", shaderProgram, 0);
-
-		GLint objectColorLoc = glGetUniformLocation(shaderProgram, "objectColor");
-		glUniform3f(objectColorLoc, 0.7f, 0.7f, 0.7f);
-
-		GLint lightPosLoc = glGetUniformLocation(shaderProgram, "lightPos");
-		glUniform3fv(lightPosLoc, 1, glm::value_ptr(lightPos));
-
-		GLint viewPosLoc = glGetUniformLocation(shaderProgram, "viewPos");
-		glUniform3fv(viewPosLoc, 1, glm::value_ptr(cameraPos));
-
-		GLint lightColorLoc = glGetUniformLocation(shaderProgram, "lightColor");
-		glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-
-		glm::mat4 rotationMatrix = getRotationMatrixFromVelocity(velocity);
-		glm::mat4 model = glm::translate(glm::mat4(1.0f), position) *
-			rotationMatrix *
+	glm::mat4 getModelMatrix() {
+		return glm::translate(glm::mat4(1.0f), position) *
+			getRotationMatrixFromVelocity(velocity) *
 			glm::scale(glm::mat4(1.0f), scale);
-
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-		Core::DrawContext(modelContext);
-
-		glUseProgram(0);
 	}
 private:
 	glm::mat4 getRotationMatrixFromVelocity(const glm::vec3& velocity) {
@@ -153,11 +140,25 @@ public:
 	std::vector<Boid> boids;
 	SimulationParams* simulationParams;
 	ProceduralTerrain* terrain;
+	Core::RenderContext modelContext;
+	GLuint textureArray = 0;
+	int textureLayers = 1;
+	glm::vec3 center = glm::vec3(0.0f);
+
+	ImpostorAtlas impostorAtlas;
+	// how many of the closest boids are drawn with the full mesh, the rest become impostors
+	int meshBudget = 2048;
+	// distance beyond which boids are impostors, follows the meshBudget-th closest boid
+	float lodDistance = std::numeric_limits<float>::max();
+
 	Flock() {}
 
-	Flock(SimulationParams* simulParams, ProceduralTerrain* terr, const Core::RenderContext& modelContext, GLuint gradientTextures[10]) {
+	Flock(SimulationParams* simulParams, ProceduralTerrain* terr, const Core::RenderContext& context, GLuint texArray, int texLayers) {
 		simulationParams = simulParams;
 		terrain = terr;
+		modelContext = context;
+		textureArray = texArray;
+		textureLayers = texLayers;
 
 		for (int i = 0; i < simulationParams->boidNumber; ++i) {
 			glm::vec3 position = glm::vec3(
@@ -172,13 +173,16 @@ public:
 				static_cast<float>(std::rand()) / RAND_MAX * 2.0f - 1.0f
 			)) * (static_cast<float>(std::rand()) / RAND_MAX * 2.0f);
 
-			GLuint randomTextureID = gradientTextures[rand() % 10];
+			int randomTextureLayer = rand() % textureLayers;
 
-			boids.emplace_back(position, velocity, modelContext, simulationParams, terrain, randomTextureID);
+			boids.emplace_back(position, velocity, simulationParams, terrain, randomTextureLayer);
 		}
+
+		setupInstancing();
 	}
 
 	void update(float deltaTime) {
+		CPU_ZONE("Flock::update");
 		for (auto& boid : boids) {
 			glm::vec3 avoidance = computeAvoidance(boid);
 			glm::vec3 alignment = computeAlignment(boid);
@@ -187,12 +191,302 @@ public:
 		}
 	}
 
-	void draw(GLuint shaderProgram, GLuint modelLoc, const glm::mat4& view, const glm::mat4& projection, GLuint viewLoc, GLuint projectionLoc, glm::vec3 cameraPos) {
-		for (auto& boid : boids) {
-			boid.draw(shaderProgram, modelLoc, view, projection, viewLoc, projectionLoc, cameraPos);
+	void bakeImpostors(GLuint bakeShader) {
+		impostorAtlas.bake(modelContext, bakeShader);
+	}
+
+	// Builds the instance lists of this frame: the colour pass splits the boids between the mesh
+	// and impostor tiers by distance to the camera, and mesh boids between the model's LOD levels
+	// by projected size. The shadow pass gets one entry per cascade the boid's bounding sphere overlaps.
+	// pixelsPerUnit - screen pixels covered by one world unit at distance 1
+	void updateInstances(const CascadedShadowMap& shadowMap, glm::vec3 cameraPos, float pixelsPerUnit) {
+		CPU_ZONE("Flock::updateInstances");
+		colorInstances.resize(boids.size());
+		for (std::vector<BoidInstance>& instances : lodInstances)
+			instances.clear();
+		impostorInstances.clear();
+		shadowInstances.clear();
+
+		center = glm::vec3(0.0f);
+		for (size_t i = 0; i < boids.size(); ++i) {
+			colorInstances[i].model = boids[i].getModelMatrix();
+			colorInstances[i].layer = static_cast<float>(boids[i].textureLayer);
+			center += boids[i].position;
+		}
+		if (!boids.empty())
+			center /= static_cast<float>(boids.size());
+
+		updateLodDistance(cameraPos);
+		float lodDistanceSquared = lodDistance * lodDistance;
+		float pixelsPerModelUnit = pixelsPerUnit * simulationParams->boidModelScale;
+		for (size_t i = 0; i < boids.size(); ++i) {
+			glm::vec3 offset = boids[i].position - cameraPos;
+			float distanceSquared = glm::dot(offset, offset);
+			if (distanceSquared > lodDistanceSquared) {
+				impostorInstances.push_back(colorInstances[i]);
+				continue;
+			}
+			int lod = modelContext.selectLod(pixelsPerModelUnit / std::max(std::sqrt(distanceSquared), 1e-3f));
+			lodInstances[std::min(lod, MAX_MESH_LODS - 1)].push_back(colorInstances[i]);
+		}
+
+		float worldRadius = modelContext.boundingRadius * simulationParams->boidModelScale;
+		for (int c = 0; c < shadowMap.cascadeCount; ++c) {
+			const glm::mat4& lightSpace = shadowMap.lightSpaceMatrices[c];
+			float radiusX = worldRadius * glm::length(glm::vec3(lightSpace[0][0], lightSpace[1][0], lightSpace[2][0]));
+			float radiusY = worldRadius * glm::length(glm::vec3(lightSpace[0][1], lightSpace[1][1], lightSpace[2][1]));
+			float radiusZ = worldRadius * glm::length(glm::vec3(lightSpace[0][2], lightSpace[1][2], lightSpace[2][2]));
+
+			for (size_t i = 0; i < boids.size(); ++i) {
+				glm::vec4 p = lightSpace * glm::vec4(boids[i].position, 1.0f);
+				if (glm::abs(p.x) > 1.0f + radiusX || glm::abs(p.y) > 1.0f + radiusY || p.z > 1.0f + radiusZ)
+					continue;
+				shadowInstances.push_back({ colorInstances[i].model, static_cast<float>(c) });
+			}
+		}
+
+		uploadMeshInstances();
+		uploadInstances(impostorInstanceBuffer, impostorInstances);
+		uploadInstances(shadowInstanceBuffer, shadowInstances);
+	}
+
+	void submit(RenderQueue& queue, GLuint shaderProgram, GLuint impostorShader, const glm::mat4& view, const glm::mat4& projection, glm::vec3 cameraPos) {
+		auto setSharedUniforms = [=](GLuint program) {
+			glUniform3f(glGetUniformLocation(program, "objectColor"), 0.7f, 0.7f, 0.7f);
+			glUniform3fv(glGetUniformLocation(program, "lightPos"), 1, glm::value_ptr(lightPos));
+			glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, glm::value_ptr(cameraPos));
+			glUniform3fv(glGetUniformLocation(program, "lightColor"), 1, glm::value_ptr(lightColor));
+			glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+			glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+			glUniform1i(glGetUniformLocation(program, "boidTextures"), 0);
+		};
+
+		refreshPoolBindings();
+		float depth = glm::length(center - cameraPos);
+		if (multiDraw) {
+			DrawItem item;
+			item.program = shaderProgram;
+			item.vertexArray = meshVertexArray;
+			item.textures[0] = { GL_TEXTURE_2D_ARRAY, textureArray };
+			item.indirectBuffer = indirectBuffer;
+			item.indirectCount = meshInstanceCount > 0 ? MAX_MESH_LODS : 0;
+			item.depth = depth;
+			item.passName = "Boids";
+			item.setUniforms = setSharedUniforms;
+			queue.submit(std::move(item));
 		}
+		for (int lod = 0; lod < MAX_MESH_LODS && !multiDraw; ++lod) {
+			DrawItem item;
+			item.program = shaderProgram;
+			item.vertexArray = meshVertexArray;
+			item.textures[0] = { GL_TEXTURE_2D_ARRAY, textureArray };
+			item.baseVertex = modelContext.baseVertex;
+			if (lod < static_cast<int>(modelContext.lods.size())) {
+				item.firstIndex = modelContext.lods[lod].firstIndex;
+				item.count = modelContext.lods[lod].count;
+			}
+			else {
+				item.firstIndex = modelContext.firstIndex;
+				item.count = lod == 0 ? modelContext.size : 0;
+			}
+			item.instanceCount = static_cast<GLsizei>(lodInstances[lod].size());
+			item.depth = depth;
+			item.passName = "Boids";
+			item.setUniforms = setSharedUniforms;
+			// all levels share the VAO, so each draw points the instance attributes at its own range
+			GLuint instanceBuffer = meshInstanceBuffer;
+			GLuint firstInstance = lodFirstInstance[lod];
+			item.prepareVertexState = [=]() {
+				bindInstanceAttributes(instanceBuffer, firstInstance);
+			};
+			queue.submit(std::move(item));
+		}
+
+		DrawItem impostors;
+		impostors.program = impostorShader;
+		impostors.vertexArray = impostorVertexArray;
+		impostors.textures[0] = { GL_TEXTURE_2D_ARRAY, textureArray };
+		impostors.textures[1] = { GL_TEXTURE_2D, impostorAtlas.uvTexture };
+		impostors.textures[2] = { GL_TEXTURE_2D, impostorAtlas.normalTexture };
+		impostors.mode = GL_TRIANGLE_STRIP;
+		impostors.count = 4;
+		impostors.indexType = GL_NONE;
+		impostors.instanceCount = static_cast<GLsizei>(impostorInstances.size());
+		impostors.depth = std::max(lodDistance, depth);
+		impostors.passName = "Boid impostors";
+		const ImpostorAtlas* atlas = &impostorAtlas;
+		impostors.setUniforms = [=](GLuint program) {
+			setSharedUniforms(program);
+			atlas->setUniforms(program, 1, 2);
+		};
+		queue.submit(std::move(impostors));
+	}
+
+	// Draws the boids into every shadow cascade with one layered instanced draw.
+	void submitDepth(RenderQueue& queue, GLuint shaderProgram, const CascadedShadowMap& shadowMap) {
+		refreshPoolBindings();
+		DrawItem item;
+		item.program = shaderProgram;
+		item.vertexArray = depthVertexArray;
+		item.firstIndex = modelContext.firstIndex;
+		item.baseVertex = modelContext.baseVertex;
+		item.count = modelContext.size;
+		item.instanceCount = static_cast<GLsizei>(shadowInstances.size());
+		item.passName = "Shadow";
+		item.setUniforms = [&shadowMap](GLuint program) {
+			shadowMap.bindLightSpace(program);
+		};
+		queue.submit(std::move(item));
 	}
 private:
+	static const int MAX_MESH_LODS = 4;
+
+	// One VAO and one instance buffer for all LOD levels, with the instances of each level back to back.
+	// Multi-draw-indirect selects a level's range with baseInstance; GL 3.3 has no base instance, so
+	// there each draw re-points the instance attributes at its range instead of switching VAOs.
+	GLuint meshVertexArray = 0;
+	GLuint meshInstanceBuffer = 0;
+	GLuint lodFirstInstance[MAX_MESH_LODS] = {};
+	bool multiDraw = false;
+	GLuint indirectBuffer = 0;
+	size_t meshInstanceCount = 0;
+	std::vector<BoidInstance> meshInstances;
+	GLuint impostorInstanceBuffer = 0;
+	GLuint shadowInstanceBuffer = 0;
+	GLuint depthVertexArray = 0;
+	GLuint impostorVertexArray = 0;
+	GLuint impostorQuadBuffer = 0;
+	// MeshPool::generation the mesh and depth VAOs were set up for
+	unsigned int poolGeneration = 0;
+	std::vector<BoidInstance> colorInstances;
+	std::vector<BoidInstance> lodInstances[MAX_MESH_LODS];
+	std::vector<BoidInstance> impostorInstances;
+	std::vector<BoidInstance> shadowInstances;
+	std::vector<float> distanceScratch;
+
+	// Moves lodDistance towards the distance of the meshBudget-th closest boid. The smoothing
+	// keeps boids near the threshold from switching tiers every frame.
+	void updateLodDistance(glm::vec3 cameraPos) {
+		if (boids.size() <= static_cast<size_t>(meshBudget)) {
+			lodDistance = std::numeric_limits<float>::max();
+			return;
+		}
+
+		distanceScratch.resize(boids.size());
+		for (size_t i = 0; i < boids.size(); ++i)
+			distanceScratch[i] = glm::length(boids[i].position - cameraPos);
+		std::nth_element(distanceScratch.begin(), distanceScratch.begin() + meshBudget, distanceScratch.end());
+		float target = distanceScratch[meshBudget];
+
+		if (lodDistance == std::numeric_limits<float>::max())
+			lodDistance = target;
+		else
+			lodDistance += (target - lodDistance) * 0.1f;
+	}
+
+	void setupInstancing() {
+		glGenBuffers(1, &meshInstanceBuffer);
+		glGenBuffers(1, &impostorInstanceBuffer);
+		glGenBuffers(1, &shadowInstanceBuffer);
+
+		glGenVertexArrays(1, &meshVertexArray);
+		glBindVertexArray(meshVertexArray);
+		bindInstanceAttributes(meshInstanceBuffer);
+
+		multiDraw = multiDrawIndirectSupported();
+		if (multiDraw)
+			glGenBuffers(1, &indirectBuffer);
+
+		glGenVertexArrays(1, &depthVertexArray);
+		glBindVertexArray(depthVertexArray);
+		bindInstanceAttributes(shadowInstanceBuffer);
+		bindPoolAttributes();
+
+		float quad[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+		glGenVertexArrays(1, &impostorVertexArray);
+		glBindVertexArray(impostorVertexArray);
+		glGenBuffers(1, &impostorQuadBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, impostorQuadBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		bindInstanceAttributes(impostorInstanceBuffer);
+
+		glBindVertexArray(0);
+	}
+
+	// Sets up the mesh pool's buffers in the mesh and depth VAOs. The shadow pass reads only
+	// positions, which come first in every vertex of the pool.
+	void bindPoolAttributes() {
+		const Core::MeshPool& meshPool = Core::GetMeshPool();
+		glBindVertexArray(meshVertexArray);
+		modelContext.bindVertexAttributes();
+
+		glBindVertexArray(depthVertexArray);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshPool.indexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, meshPool.vertexBuffer);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, Core::MeshPool::VERTEX_STRIDE, (void*)0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		poolGeneration = meshPool.generation();
+	}
+
+	// Growing the mesh pool replaces its buffers, which the VAOs above still point to
+	void refreshPoolBindings() {
+		if (poolGeneration != Core::GetMeshPool().generation())
+			bindPoolAttributes();
+	}
+
+	// Puts the instances of all LOD levels back to back in one buffer. With multi-draw-indirect it
+	// also writes one command per level; baseInstance makes each command read its own range.
+	void uploadMeshInstances() {
+		DrawElementsIndirectCommand commands[MAX_MESH_LODS] = {};
+		meshInstances.clear();
+		for (int lod = 0; lod < MAX_MESH_LODS; ++lod) {
+			lodFirstInstance[lod] = static_cast<GLuint>(meshInstances.size());
+			DrawElementsIndirectCommand& command = commands[lod];
+			if (lod < static_cast<int>(modelContext.lods.size())) {
+				command.count = modelContext.lods[lod].count;
+				command.firstIndex = modelContext.lods[lod].firstIndex;
+				command.instanceCount = static_cast<GLuint>(lodInstances[lod].size());
+			}
+			command.baseVertex = modelContext.baseVertex;
+			command.baseInstance = static_cast<GLuint>(meshInstances.size());
+			meshInstances.insert(meshInstances.end(), lodInstances[lod].begin(), lodInstances[lod].end());
+		}
+		meshInstanceCount = meshInstances.size();
+
+		uploadInstances(meshInstanceBuffer, meshInstances);
+		if (!multiDraw)
+			return;
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(commands), commands, GL_STREAM_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// The model matrix takes locations 5-8, the layer location 9. Instance 0 of the draw reads
+	// firstInstance of the buffer.
+	static void bindInstanceAttributes(GLuint buffer, GLuint firstInstance = 0) {
+		size_t base = firstInstance * sizeof(BoidInstance);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		for (int i = 0; i < 4; ++i) {
+			glEnableVertexAttribArray(5 + i);
+			glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(BoidInstance), (void*)(base + i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(5 + i, 1);
+		}
+		glEnableVertexAttribArray(9);
+		glVertexAttribPointer(9, 1, GL_FLOAT, GL_FALSE, sizeof(BoidInstance), (void*)(base + offsetof(BoidInstance, layer)));
+		glVertexAttribDivisor(9, 1);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	static void uploadInstances(GLuint buffer, const std::vector<BoidInstance>& instances) {
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(BoidInstance), instances.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
 	glm::vec3 computeAvoidance(const Boid& boid) {
 		glm::vec3 avoidance(0.0f);
 		int count = 0;
@@ -14,117 +14,251 @@
 #include <vector>
 #include <random>
 #include <numeric>
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <cstdint>
+
+#include "TerrainNoise.h"
+#include "../loading/JobSystem.h"
+#include "../profiling/StartupReport.h"
+#include "../rendering/CascadedShadowMap.h"
+#include "../rendering/RenderQueue.h"
+
+// Compact terrain vertex (12 bytes instead of 14 floats). The x/z position and the UVs follow
+// from the vertex's place in the grid (gl_VertexID), the height is quantized to 16 bits and the
+// normal and tangent are octahedral-encoded. The bitangent is rebuilt in the shader.
+struct TerrainVertex {
+	GLushort height;
+	GLshort bitangentSign;
+	GLshort normal[2];
+	GLshort tangent[2];
+};
 
-class PerlinNoise {
+// Endless terrain streamed in chunks around the camera. A chunk covers one tile of the height
+// lattice (TerrainTileCache::TILE_QUADS quads a side). update() keeps the square ring of
+// chunks within ringRadius of the camera's chunk: missing chunks are built as jobs on the
+// shared worker pool, nearest first, and uploaded on the GL thread within budgetBytes per
+// frame. Chunk vertices live in a fixed number of buffer slots; when all are taken, the least
+// recently drawn chunk gives its slot up, and the height tiles are trimmed the same way, so
+// memory stays bounded however far the camera travels. Height tiles also go to the disk cache
+// of TerrainTileCache, so a later run or a revisited chunk reads them instead of the noise.
+class ProceduralTerrain {
 private:
-	std::vector<int> p;
-
-	static float fade(float t) {
-		return t * t * t * (t * (t * 6 - 15) + 10);
+	static const int CHUNK_QUADS = TerrainTileCache::TILE_QUADS;
+	static const int CHUNK_SAMPLES = TerrainTileCache::TILE_SAMPLES;
+	static const size_t CHUNK_BYTES = static_cast<size_t>(CHUNK_SAMPLES) * CHUNK_SAMPLES * sizeof(TerrainVertex);
+
+	typedef std::pair<int, int> ChunkKey;
+
+	struct BuiltChunk {
+		ChunkKey key;
+		std::vector<TerrainVertex> vertices;
+	};
+
+	struct ResidentChunk {
+		int slot;
+		uint64_t lastDrawnFrame;
+	};
+
+	TerrainParams params;
+	float spacing;
+	// terrain-space x/z of lattice sample (0, 0)
+	glm::vec2 latticeOrigin;
+	int ringRadius;
+	TerrainTileCache tileCache;
+	size_t maxTiles;
+	JobSystem& jobs;
+
+	GLuint chunkEBO = 0;
+	GLsizei indexCount = 0;
+	// one vertex buffer and vertex array per slot, all sharing the index buffer
+	std::vector<GLuint> slotVBOs;
+	std::vector<GLuint> slotVAOs;
+	std::vector<int> freeSlots;
+
+	std::map<ChunkKey, ResidentChunk> resident;
+	// chunks queued or being built and height tiles queued for getTerrainHeight; touched only on
+	// the GL thread
+	std::set<ChunkKey> requested;
+	std::set<ChunkKey> requestedTiles;
+	// tile of the previous getTerrainHeight query; neighbouring queries mostly hit it again
+	// and skip the lock and the map lookup of TerrainTileCache::find
+	std::shared_ptr<const TerrainTileCache::Tile> heightTile;
+	ChunkKey heightTileKey = ChunkKey(0, 0);
+	// the rest is shared with the jobs
+	std::mutex builtMutex;
+	std::condition_variable jobFinished;
+	std::deque<BuiltChunk> built;
+	std::vector<ChunkKey> loadedTiles;
+	int jobsRunning = 0;
+	// resident chunks of the current ring, drawn by submit and submitDepth
+	std::vector<std::pair<ChunkKey, int>> visible;
+	ChunkKey centerChunk = ChunkKey(0, 0);
+	uint64_t frame = 0;
+
+	glm::vec3 position = glm::vec3(0.0f);
+
+	static GLshort packSnorm(float v) {
+		return static_cast<GLshort>(std::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f));
 	}
 
-	static float lerp(float t, float a, float b) {
-		return a + t * (b - a);
+	static void packOctahedral(glm::vec3 n, GLshort out[2]) {
+		n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+		glm::vec2 p(n.x, n.y);
+		if (n.z < 0.0f) {
+			p = glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+				(1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+		}
+		out[0] = packSnorm(p.x);
+		out[1] = packSnorm(p.y);
 	}
 
-	static float grad(int hash, float x, float y, float z) {
-		int h = hash & 15;
-		float u = h < 8 ? x : y;
-		float v = h < 4 ? y : h == 12 || h == 14 ? x : z;
-		return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+	static int chunkDistance(const ChunkKey& a, const ChunkKey& b) {
+		return std::max(std::abs(a.first - b.first), std::abs(a.second - b.second));
 	}
 
-public:
-	PerlinNoise() {
-		p.resize(256);
-		std::iota(p.begin(), p.end(), 0);
-		std::shuffle(p.begin(), p.end(), std::default_random_engine());
-
-		p.insert(p.end(), p.begin(), p.end());
+	// Runs on a worker thread. Normals and tangents come from central differences; the samples
+	// one step past the chunk border are read from the neighbouring tiles, so the shading is
+	// continuous across chunks.
+	BuiltChunk buildChunk(ChunkKey key) {
+		StartupPhase phase("Terrain chunks");
+		int tileX = key.first, tileZ = key.second;
+		std::shared_ptr<const TerrainTileCache::Tile> center = tileCache.tile(tileX, tileZ);
+		std::shared_ptr<const TerrainTileCache::Tile> left = tileCache.tile(tileX - 1, tileZ);
+		std::shared_ptr<const TerrainTileCache::Tile> right = tileCache.tile(tileX + 1, tileZ);
+		std::shared_ptr<const TerrainTileCache::Tile> below = tileCache.tile(tileX, tileZ - 1);
+		std::shared_ptr<const TerrainTileCache::Tile> above = tileCache.tile(tileX, tileZ + 1);
+		auto height = [&](int x, int z) {
+			if (x < 0)
+				return left->height(x + CHUNK_QUADS, z);
+			if (x > CHUNK_QUADS)
+				return right->height(x - CHUNK_QUADS, z);
+			if (z < 0)
+				return below->height(x, z + CHUNK_QUADS);
+			if (z > CHUNK_QUADS)
+				return above->height(x, z - CHUNK_QUADS);
+			return center->height(x, z);
+		};
+
+		// every chunk is quantized over the whole noise range, so equal heights on the shared
+		// border of two chunks decode to the same value
+		float heightExtent = std::max(params.heightScale, 1e-6f);
+		BuiltChunk chunk;
+		chunk.key = key;
+		chunk.vertices.resize(static_cast<size_t>(CHUNK_SAMPLES) * CHUNK_SAMPLES);
+		for (int z = 0; z < CHUNK_SAMPLES; ++z) {
+			for (int x = 0; x < CHUNK_SAMPLES; ++x) {
+				// tangent follows u (+x), bitangent follows v (+z)
+				glm::vec3 tangent = glm::normalize(glm::vec3(2.0f * spacing, height(x + 1, z) - height(x - 1, z), 0.0f));
+				glm::vec3 bitangent = glm::normalize(glm::vec3(0.0f, height(x, z + 1) - height(x, z - 1), 2.0f * spacing));
+				glm::vec3 normal = glm::normalize(glm::cross(bitangent, tangent));
+
+				TerrainVertex& packed = chunk.vertices[static_cast<size_t>(z) * CHUNK_SAMPLES + x];
+				packed.height = static_cast<GLushort>(std::round(glm::clamp(center->height(x, z) / heightExtent, 0.0f, 1.0f) * 65535.0f));
+				packed.bitangentSign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? -1 : 1;
+				packOctahedral(normal, packed.normal);
+				packOctahedral(tangent, packed.tangent);
+			}
+		}
+		return chunk;
 	}
 
-	float noise(float x, float y, float z) const {
-		int X = (int)floor(x) & 255;
-		int Y = (int)floor(y) & 255;
-		int Z = (int)floor(z) & 255;
-
-		x -= floor(x);
-		y -= floor(y);
-		z -= floor(z);
-
-		float u = fade(x);
-		float v = fade(y);
-		float w = fade(z);
-
-		int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
-		int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
-
-		return lerp(w, lerp(v, lerp(u, grad(p[AA], x, y, z), grad(p[BA], x - 1, y, z)),
-			lerp(u, grad(p[AB], x, y - 1, z), grad(p[BB], x - 1, y - 1, z))),
-			lerp(v, lerp(u, grad(p[AA + 1], x, y, z - 1), grad(p[BA + 1], x - 1, y, z - 1)),
-				lerp(u, grad(p[AB + 1], x, y - 1, z - 1), grad(p[BB + 1], x - 1, y - 1, z - 1))));
+	void requestChunk(ChunkKey key) {
+		requested.insert(key);
+		submitJob([this, key]() {
+			BuiltChunk chunk = buildChunk(key);
+			std::lock_guard<std::mutex> lock(builtMutex);
+			built.push_back(std::move(chunk));
+		});
 	}
-};
 
-class ProceduralTerrain {
-private:
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec3> normals;
-	std::vector<glm::vec3> tangents;
-	std::vector<glm::vec3> bitangents;
-	std::vector<GLuint> indices;
-	GLuint terrainVAO, terrainVBO, terrainEBO;
-	std::vector<std::vector<float>> heightMap;
-	float planeSize;
-	int resolution;
-	PerlinNoise perlinNoise;
-	std::vector<glm::vec2> uvs;
-
-public:
-	bool wireframeOnlyView = false;
-	ProceduralTerrain(float size = 10.0f, int res = 10)
-		: planeSize(size), resolution(res) {
-		generateTerrain();
-		setupMesh();
+	void requestTile(ChunkKey key) {
+		requestedTiles.insert(key);
+		submitJob([this, key]() {
+			tileCache.tile(key.first, key.second);
+			std::lock_guard<std::mutex> lock(builtMutex);
+			loadedTiles.push_back(key);
+		});
 	}
-	void generateTerrain() {
-		vertices.clear();
-		indices.clear();
-		uvs.clear();
-		tangents.clear();
-		bitangents.clear();
-		normals.clear();
 
-		float frequency = .05f;
-		float heightScale = 30.0f;
-		heightMap.resize(resolution + 1, std::vector<float>(resolution + 1));
-
-		for (int z = 0; z <= resolution; ++z) {
-			for (int x = 0; x <= resolution; ++x) {
-				float xPos = (x / static_cast<float>(resolution)) * planeSize - (planeSize / 2.0f);
-				float zPos = (z / static_cast<float>(resolution)) * planeSize - (planeSize / 2.0f);
-
-				float noise = perlinNoise.noise(xPos * frequency, 1.0f, zPos * frequency);
-				noise = (noise + 1.0f) / 2.0f * heightScale;
-
-				vertices.push_back(glm::vec3(xPos, noise, zPos));
-				heightMap[z][x] = noise;
+	// Jobs are counted, so the destructor can wait for the ones still running on the pool.
+	template <typename Job>
+	void submitJob(Job job) {
+		{
+			std::lock_guard<std::mutex> lock(builtMutex);
+			++jobsRunning;
+		}
+		jobs.submit([this, job]() {
+			job();
+			std::lock_guard<std::mutex> lock(builtMutex);
+			--jobsRunning;
+			jobFinished.notify_all();
+		});
+	}
 
-				float u = x / static_cast<float>(resolution);
-				float v = z / static_cast<float>(resolution);
-				uvs.push_back(glm::vec2(u, v));
+	// A free slot, or the slot of the chunk drawn longest ago (the farthest one on a tie).
+	int acquireSlot() {
+		if (!freeSlots.empty()) {
+			int slot = freeSlots.back();
+			freeSlots.pop_back();
+			return slot;
+		}
+		auto victim = resident.begin();
+		for (auto chunk = resident.begin(); chunk != resident.end(); ++chunk) {
+			if (chunk->second.lastDrawnFrame < victim->second.lastDrawnFrame
+				|| (chunk->second.lastDrawnFrame == victim->second.lastDrawnFrame
+					&& chunkDistance(chunk->first, centerChunk) > chunkDistance(victim->first, centerChunk)))
+				victim = chunk;
+		}
+		int slot = victim->second.slot;
+		resident.erase(victim);
+		return slot;
+	}
 
-				normals.push_back(glm::vec3(0.0f));
-				tangents.push_back(glm::vec3(0.0f));
-				bitangents.push_back(glm::vec3(0.0f));
+	// Uploads built chunks until budgetBytes is spent; at least one goes if any is waiting.
+	// Chunks the camera has left behind while they were being built are dropped.
+	void uploadBuilt() {
+		size_t uploaded = 0;
+		while (uploaded == 0 || uploaded + CHUNK_BYTES <= budgetBytes) {
+			BuiltChunk chunk;
+			{
+				std::lock_guard<std::mutex> lock(builtMutex);
+				if (built.empty())
+					break;
+				chunk = std::move(built.front());
+				built.pop_front();
 			}
+			requested.erase(chunk.key);
+			if (chunkDistance(chunk.key, centerChunk) > ringRadius + 1)
+				continue;
+
+			int slot = acquireSlot();
+			// a new data store for the slot, so the GPU never waits on a draw of the chunk it held
+			glBindBuffer(GL_ARRAY_BUFFER, slotVBOs[slot]);
+			glBufferData(GL_ARRAY_BUFFER, CHUNK_BYTES, chunk.vertices.data(), GL_STATIC_DRAW);
+			resident[chunk.key] = { slot, frame };
+			uploaded += CHUNK_BYTES;
 		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-		for (int z = 0; z < resolution; ++z) {
-			for (int x = 0; x < resolution; ++x) {
-				int topLeft = z * (resolution + 1) + x;
+	void generateIndices(std::vector<GLuint>& indices) const {
+		indices.clear();
+		indices.reserve(static_cast<size_t>(CHUNK_QUADS) * CHUNK_QUADS * 6);
+		for (int z = 0; z < CHUNK_QUADS; ++z) {
+			for (int x = 0; x < CHUNK_QUADS; ++x) {
+				int topLeft = z * (CHUNK_QUADS + 1) + x;
 				int topRight = topLeft + 1;
-				int bottomLeft = (z + 1) * (resolution + 1) + x;
+				int bottomLeft = (z + 1) * (CHUNK_QUADS + 1) + x;
 				int bottomRight = bottomLeft + 1;
 
 				indices.push_back(topLeft);
@@ -136,180 +270,254 @@ public:
 				indices.push_back(bottomRight);
 			}
 		}
+	}
 
-		for (size_t i = 0; i < indices.size(); i += 3) {
-			GLuint i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
-			glm::vec3 v0 = vertices[i0], v1 = vertices[i1], v2 = vertices[i2];
-			glm::vec2 uv0 = uvs[i0], uv1 = uvs[i1], uv2 = uvs[i2];
+	void setupSlots(int slotCount) {
+		std::vector<GLuint> indices;
+		generateIndices(indices);
+		indexCount = static_cast<GLsizei>(indices.size());
+		glGenBuffers(1, &chunkEBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunkEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-			glm::vec3 deltaPos1 = v1 - v0;
-			glm::vec3 deltaPos2 = v2 - v0;
-			glm::vec2 deltaUV1 = uv1 - uv0;
-			glm::vec2 deltaUV2 = uv2 - uv0;
+		slotVBOs.resize(slotCount);
+		slotVAOs.resize(slotCount);
+		glGenBuffers(slotCount, slotVBOs.data());
+		glGenVertexArrays(slotCount, slotVAOs.data());
+		GLsizei stride = sizeof(TerrainVertex);
+		for (int slot = 0; slot < slotCount; ++slot) {
+			glBindVertexArray(slotVAOs[slot]);
+			glBindBuffer(GL_ARRAY_BUFFER, slotVBOs[slot]);
+			glBufferData(GL_ARRAY_BUFFER, CHUNK_BYTES, NULL, GL_STATIC_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunkEBO);
 
-			float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x + 1e-6);
-			glm::vec3 tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
-			glm::vec3 bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r;
-			glm::vec3 normal = glm::normalize(glm::cross(deltaPos1, deltaPos2));
+			glVertexAttribPointer(0, 1, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(TerrainVertex, height));
+			glEnableVertexAttribArray(0);
 
-			tangents[i0] += tangent;
-			tangents[i1] += tangent;
-			tangents[i2] += tangent;
+			glVertexAttribPointer(1, 1, GL_SHORT, GL_FALSE, stride, (void*)offsetof(TerrainVertex, bitangentSign));
+			glEnableVertexAttribArray(1);
 
-			bitangents[i0] += bitangent;
-			bitangents[i1] += bitangent;
-			bitangents[i2] += bitangent;
+			glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(TerrainVertex, normal));
+			glEnableVertexAttribArray(2);
 
-			normals[i0] += normal;
-			normals[i1] += normal;
-			normals[i2] += normal;
-		}
+			glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(TerrainVertex, tangent));
+			glEnableVertexAttribArray(3);
 
-		for (size_t i = 0; i < vertices.size(); ++i) {
-			normals[i] = glm::normalize(normals[i]);
-			tangents[i] = glm::normalize(tangents[i]);
-			bitangents[i] = glm::normalize(bitangents[i]);
+			freeSlots.push_back(slotCount - 1 - slot);
 		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 
+public:
+	bool wireframeOnlyView = false;
+	// vertex bytes uploaded per frame; a chunk bigger than the budget still goes alone
+	size_t budgetBytes = 4 * CHUNK_BYTES;
+
+	// size and resolution of the params set the sample spacing and where the lattice starts;
+	// radius is the number of chunks drawn on each side of the camera's chunk. Chunks are built
+	// on jobSystem, which has to outlive the terrain. Height tiles are cached in cacheDirectory
+	// (none if empty); regenerate computes them from noise even if a cached tile exists.
+	ProceduralTerrain(const TerrainParams& terrainParams, JobSystem& jobSystem, const std::string& cacheDirectory = "",
+		bool regenerate = false, int radius = 3)
+		: params(terrainParams), spacing(terrainParams.size / terrainParams.resolution),
+		latticeOrigin(-terrainParams.size / 2.0f), ringRadius(radius),
+		tileCache(terrainParams, cacheDirectory, regenerate), jobs(jobSystem) {
+		// the ring plus a border of chunks kept for when the camera turns back
+		int slotsPerSide = 2 * ringRadius + 3;
+		setupSlots(slotsPerSide * slotsPerSide);
+		// building the outermost chunks also reads the tiles one step further out
+		maxTiles = static_cast<size_t>(slotsPerSide + 2) * (slotsPerSide + 2);
+	}
 
-	void setupMesh() {
-		glGenVertexArrays(1, &terrainVAO);
-		glBindVertexArray(terrainVAO);
-
-		glGenBuffers(1, &terrainVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, terrainVBO);
-
-		std::vector<float> vertexData;
-		for (size_t i = 0; i < vertices.size(); ++i) {
-			vertexData.push_back(vertices[i].x);
-			vertexData.push_back(vertices[i].y);
-			vertexData.push_back(vertices[i].z);
-			vertexData.push_back(uvs[i].x);
-			vertexData.push_back(uvs[i].y);
-			vertexData.push_back(normals[i].x);
-			vertexData.push_back(normals[i].y);
-			vertexData.push_back(normals[i].z);
-			vertexData.push_back(tangents[i].x);
-			vertexData.push_back(tangents[i].y);
-			vertexData.push_back(tangents[i].z);
-			vertexData.push_back(bitangents[i].x);
-			vertexData.push_back(bitangents[i].y);
-			vertexData.push_back(bitangents[i].z);
-		}
-		glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(float), vertexData.data(), GL_STATIC_DRAW);
-
-		glGenBuffers(1, &terrainEBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrainEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	static TerrainParams makeParams(float size, int res) {
+		TerrainParams terrainParams;
+		terrainParams.size = size;
+		terrainParams.resolution = res;
+		return terrainParams;
+	}
 
-		GLsizei stride = 14 * sizeof(float);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-		glEnableVertexAttribArray(0);
+	// Call once per frame on the GL thread.
+	void update(const glm::vec3& cameraPos) {
+		CPU_ZONE("Terrain streaming");
+		++frame;
+		centerChunk = chunkAt(cameraPos.x, cameraPos.z);
+		{
+			// these tiles may be requested again if they get trimmed before they are read
+			std::lock_guard<std::mutex> lock(builtMutex);
+			for (const ChunkKey& key : loadedTiles)
+				requestedTiles.erase(key);
+			loadedTiles.clear();
+		}
+		uploadBuilt();
+
+		visible.clear();
+		std::vector<std::pair<int, ChunkKey>> missing;
+		for (int dz = -ringRadius; dz <= ringRadius; ++dz) {
+			for (int dx = -ringRadius; dx <= ringRadius; ++dx) {
+				ChunkKey key(centerChunk.first + dx, centerChunk.second + dz);
+				auto found = resident.find(key);
+				if (found != resident.end()) {
+					found->second.lastDrawnFrame = frame;
+					visible.push_back({ key, found->second.slot });
+				}
+				else if (requested.count(key) == 0) {
+					missing.push_back({ dx * dx + dz * dz, key });
+				}
+			}
+		}
 
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
-		glEnableVertexAttribArray(1);
+		// a few builds at a time, so a camera moving fast does not queue chunks it has passed
+		std::sort(missing.begin(), missing.end());
+		size_t maxInFlight = static_cast<size_t>(2 * std::max(1, jobs.workerCount()));
+		for (const auto& chunk : missing) {
+			if (requested.size() >= maxInFlight)
+				break;
+			requestChunk(chunk.second);
+		}
+		tileCache.trim(maxTiles);
+	}
 
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(float)));
-		glEnableVertexAttribArray(2);
+	// True once every chunk of the ring around the camera of the last update is resident.
+	bool ready() const {
+		return visible.size() == static_cast<size_t>(2 * ringRadius + 1) * (2 * ringRadius + 1);
+	}
 
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)(8 * sizeof(float)));
-		glEnableVertexAttribArray(3);
+	// Builds and uploads the whole ring around cameraPos regardless of the budget.
+	void finish(const glm::vec3& cameraPos) {
+		size_t budget = budgetBytes;
+		budgetBytes = (size_t)-1;
+		update(cameraPos);
+		while (!ready()) {
+			std::this_thread::yield();
+			update(cameraPos);
+		}
+		budgetBytes = budget;
+	}
 
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)(11 * sizeof(float)));
-		glEnableVertexAttribArray(4);
+	size_t residentChunkCount() const {
+		return resident.size();
+	}
 
-		glBindVertexArray(0);
+	// Grid placement and quantization ranges needed to decode TerrainVertex of one chunk in the
+	// terrain shaders. Expects shaderProgram to be in use.
+	void setGridUniforms(GLuint shaderProgram, ChunkKey key) const {
+		glm::vec2 chunk(static_cast<float>(key.first), static_cast<float>(key.second));
+		glm::vec2 gridOrigin = latticeOrigin + chunk * (CHUNK_QUADS * spacing);
+		glUniform1i(glGetUniformLocation(shaderProgram, "gridResolution"), CHUNK_QUADS);
+		glUniform2fv(glGetUniformLocation(shaderProgram, "gridOrigin"), 1, glm::value_ptr(gridOrigin));
+		glUniform1f(glGetUniformLocation(shaderProgram, "gridSpacing"), spacing);
+		glUniform2f(glGetUniformLocation(shaderProgram, "heightRange"), 0.0f, std::max(params.heightScale, 1e-6f));
+		// the texture repeats once per chunk
+		glUniform2fv(glGetUniformLocation(shaderProgram, "uvOffset"), 1, glm::value_ptr(chunk));
 	}
 
-	void render(GLuint shaderProgram, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
-		GLuint textureID, GLuint normalMapID, GLuint shadowMap,
-		glm::vec3 cameraPos, glm::vec3 lightPos, glm::mat4 lightSpaceMatrix)
+	void submit(RenderQueue& queue, GLuint shaderProgram, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& parentModel,
+		GLuint textureID, GLuint normalMapID, const CascadedShadowMap& shadowMap,
+		glm::vec3 cameraPos, glm::vec3 lightPos)
 	{
-		glUseProgram(shaderProgram);
-
-		GLint projLoc = glGetUniformLocation(shaderProgram, "projection");
-		GLint viewLoc = glGetUniformLocation(shaderProgram, "view");
-		GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-		GLint lightPosLoc = glGetUniformLocation(shaderProgram, "lightPos");
-		GLint lightColLoc = glGetUniformLocation(shaderProgram, "lightColor");
-		GLint viewPosLoc = glGetUniformLocation(shaderProgram, "viewPos");
-		GLint lightSpaceLoc = glGetUniformLocation(shaderProgram, "lightSpaceMatrix");
-
-		glUniform3fv(lightPosLoc, 1, glm::value_ptr(lightPos));
-		glUniform3fv(viewPosLoc, 1, glm::value_ptr(cameraPos));
-		glUniform3fv(lightColLoc, 1, glm::value_ptr(glm::vec3(1.0f))); // White light color
-
-		glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		glUniformMatrix4fv(lightSpaceLoc, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-
-		Core::SetActiveTexture(textureID, "terrainTexture", shaderProgram, 0);
-		Core::SetActiveTexture(normalMapID, "normalMap", shaderProgram, 1);
-		Core::SetActiveTexture(shadowMap, "shadowMap", shaderProgram, 2);
-
-		glBindVertexArray(terrainVAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		glm::mat4 model = parentModel * getModelMatrix();
+		for (const auto& chunk : visible) {
+			ChunkKey key = chunk.first;
+			DrawItem item;
+			item.program = shaderProgram;
+			item.vertexArray = slotVAOs[chunk.second];
+			item.textures[0] = { GL_TEXTURE_2D, textureID };
+			item.textures[1] = { GL_TEXTURE_2D, normalMapID };
+			item.textures[2] = { GL_TEXTURE_2D_ARRAY, shadowMap.depthMapArray };
+			item.count = indexCount;
+			item.passName = "Terrain";
+			item.setUniforms = [=, &shadowMap](GLuint program) {
+				glUniform3fv(glGetUniformLocation(program, "lightPos"), 1, glm::value_ptr(lightPos));
+				glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, glm::value_ptr(cameraPos));
+				glUniform3fv(glGetUniformLocation(program, "lightColor"), 1, glm::value_ptr(glm::vec3(1.0f))); // White light color
+
+				glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+				glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+				glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+
+				setGridUniforms(program, key);
+
+				glUniform1i(glGetUniformLocation(program, "terrainTexture"), 0);
+				glUniform1i(glGetUniformLocation(program, "normalMap"), 1);
+				shadowMap.setUniforms(program, 2);
+			};
+			queue.submit(std::move(item));
+		}
 	}
 
+	void submitDepth(RenderQueue& queue, GLuint shaderProgram, const glm::mat4& parentModel, const CascadedShadowMap& shadowMap)
+	{
+		glm::mat4 model = parentModel * getModelMatrix();
+		for (const auto& chunk : visible) {
+			ChunkKey key = chunk.first;
+			DrawItem item;
+			item.program = shaderProgram;
+			item.vertexArray = slotVAOs[chunk.second];
+			item.count = indexCount;
+			item.instanceCount = shadowMap.cascadeCount;
+			item.passName = "Shadow";
+			item.setUniforms = [=, &shadowMap](GLuint program) {
+				glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+				setGridUniforms(program, key);
+				shadowMap.bindLightSpace(program);
+			};
+			queue.submit(std::move(item));
+		}
+	}
 
+	// Moves the terrain without touching its vertices: the offset is applied through the model
+	// matrix at draw time and folded into getTerrainHeight.
 	void translateTerrain(const glm::vec3& offset) {
-		for (size_t i = 0; i < vertices.size(); ++i) {
-			vertices[i] += offset;
-
-			uvs[i].x += offset.x / planeSize;
-			uvs[i].y += offset.z / planeSize;
-		}
+		position += offset;
+	}
 
-		if (offset.y != 0.0f) {
-			for (auto& row : heightMap) {
-				for (auto& height : row) {
-					height += offset.y;
-				}
-			}
-		}
+	glm::vec3 getPosition() const {
+		return position;
+	}
 
-		glBindBuffer(GL_ARRAY_BUFFER, terrainVBO);
-
-		std::vector<float> vertexData;
-		for (size_t i = 0; i < vertices.size(); ++i) {
-			vertexData.push_back(vertices[i].x);
-			vertexData.push_back(vertices[i].y);
-			vertexData.push_back(vertices[i].z);
-			vertexData.push_back(uvs[i].x);
-			vertexData.push_back(uvs[i].y);
-			vertexData.push_back(normals[i].x);
-			vertexData.push_back(normals[i].y);
-			vertexData.push_back(normals[i].z);
-			vertexData.push_back(tangents[i].x);
-			vertexData.push_back(tangents[i].y);
-			vertexData.push_back(tangents[i].z);
-			vertexData.push_back(bitangents[i].x);
-			vertexData.push_back(bitangents[i].y);
-			vertexData.push_back(bitangents[i].z);
-		}
+	glm::mat4 getModelMatrix() const {
+		return glm::translate(glm::mat4(1.0f), position);
+	}
 
-		glBufferSubData(GL_ARRAY_BUFFER, 0, vertexData.size() * sizeof(float), vertexData.data());
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// chunk under world-space x/z
+	ChunkKey chunkAt(float x, float z) const {
+		float chunkSize = CHUNK_QUADS * spacing;
+		return ChunkKey(static_cast<int>(std::floor((x - position.x - latticeOrigin.x) / chunkSize)),
+			static_cast<int>(std::floor((z - position.z - latticeOrigin.y) / chunkSize)));
 	}
+
+	// Reads the height tiles, not the chunk meshes, so it also works where no chunk is resident.
+	// It never computes a tile on the calling thread: a missing tile is queued on the worker pool
+	// and until it arrives -infinity is returned, so nothing collides with it. Call on the GL thread.
 	float getTerrainHeight(float x, float z) {
-		float gridX = (x + planeSize / 2.0f) / planeSize * resolution;
-		float gridZ = (z + planeSize / 2.0f) / planeSize * resolution;
+		float gridX = (x - position.x - latticeOrigin.x) / spacing;
+		float gridZ = (z - position.z - latticeOrigin.y) / spacing;
 
 		int x0 = static_cast<int>(floor(gridX));
 		int z0 = static_cast<int>(floor(gridZ));
-		int x1 = x0 + 1;
-		int z1 = z0 + 1;
-
-		if (x0 < 0 || z0 < 0 || x1 >= resolution + 1 || z1 >= resolution + 1)
+		// a tile holds its far border too, so all four samples come from one tile
+		int tileX = TerrainTileCache::floorDiv(x0, CHUNK_QUADS);
+		int tileZ = TerrainTileCache::floorDiv(z0, CHUNK_QUADS);
+		ChunkKey key(tileX, tileZ);
+		if (!heightTile || heightTileKey != key) {
+			heightTile = tileCache.find(tileX, tileZ);
+			heightTileKey = key;
+		}
+		if (!heightTile) {
+			if (requestedTiles.count(key) == 0)
+				requestTile(key);
 			return -std::numeric_limits<float>::infinity();
+		}
+		const TerrainTileCache::Tile* tile = heightTile.get();
+		int localX = x0 - tileX * CHUNK_QUADS;
+		int localZ = z0 - tileZ * CHUNK_QUADS;
 
-		float h00 = heightMap[z0][x0];
-		float h10 = heightMap[z0][x1];
-		float h01 = heightMap[z1][x0];
-		float h11 = heightMap[z1][x1];
+		float h00 = tile->height(localX, localZ);
+		float h10 = tile->height(localX + 1, localZ);
+		float h01 = tile->height(localX, localZ + 1);
+		float h11 = tile->height(localX + 1, localZ + 1);
 
 		float dx = gridX - x0;
 		float dz = gridZ - z0;
@@ -319,12 +527,19 @@ public:
 			(1 - dx) * dz * h01 +
 			dx * dz * h11;
 
-		return height;
+		return height + position.y;
 	}
 
 	~ProceduralTerrain() {
-		glDeleteVertexArrays(1, &terrainVAO);
-		glDeleteBuffers(1, &terrainVBO);
-		glDeleteBuffers(1, &terrainEBO);
+		// the jobs still queued or running use the tile cache and the built queue
+		{
+			std::unique_lock<std::mutex> lock(builtMutex);
+			jobFinished.wait(lock, [this]() { return jobsRunning == 0; });
+		}
+		if (!slotVAOs.empty()) {
+			glDeleteVertexArrays(static_cast<GLsizei>(slotVAOs.size()), slotVAOs.data());
+			glDeleteBuffers(static_cast<GLsizei>(slotVBOs.size()), slotVBOs.data());
+		}
+		glDeleteBuffers(1, &chunkEBO);
 	}
-};
+};
\ No newline at end of file
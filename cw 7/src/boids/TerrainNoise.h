@@ -0,0 +1,744 @@
+#pragma once
+#include "glm.hpp"
+#include "ext.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "../Mapped_File.h"
+#include "../profiling/StartupReport.h"
+
+// Improved Perlin noise. Besides single samples it evaluates whole arrays of them; with AVX2
+// (__AVX2__, /arch:AVX2 on MSVC) eight samples go through one pass of the loop, otherwise the
+// batch falls back to the scalar code. The gradient is picked with selects instead of branches,
+// and the results match noise() exactly as long as the compiler does not contract the scalar
+// multiply-adds differently. A Slice fixes y and precomputes per-cell coefficients, which makes
+// it the fast path for the 2D terrain.
+class PerlinNoise {
+private:
+	// two copies of the permutation so p[i + 1] never wraps
+	uint8_t p[512];
+
+	static float fade(float t) {
+		return t * t * t * (t * (t * 6 - 15) + 10);
+	}
+
+	static float lerp(float t, float a, float b) {
+		return a + t * (b - a);
+	}
+
+	// u = h < 8 ? x : y, v = h < 4 ? y : h == 12 || h == 14 ? x : z, bits 0 and 1 flip the signs
+	static float grad(int hash, float x, float y, float z) {
+		int h = hash & 15;
+		float u = h < 8 ? x : y;
+		float v = h < 4 ? y : (h & 13) == 12 ? x : z;
+		return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+	}
+
+	// y fixed for all samples of a batch: its lattice cell and fade weight are computed once
+	struct FixedY {
+		int cell;
+		float y;
+		float v;
+	};
+
+	static FixedY fixY(float y) {
+		float floorY = std::floor(y);
+		FixedY fixed;
+		fixed.cell = (int)floorY & 255;
+		fixed.y = y - floorY;
+		fixed.v = fade(fixed.y);
+		return fixed;
+	}
+
+	float noiseFixedY(float x, const FixedY& fixed, float z) const {
+		float floorX = std::floor(x), floorZ = std::floor(z);
+		int X = (int)floorX & 255;
+		int Z = (int)floorZ & 255;
+		x -= floorX;
+		z -= floorZ;
+		float y = fixed.y;
+
+		float u = fade(x);
+		float v = fixed.v;
+		float w = fade(z);
+
+		int A = p[X] + fixed.cell, AA = p[A] + Z, AB = p[A + 1] + Z;
+		int B = p[X + 1] + fixed.cell, BA = p[B] + Z, BB = p[B + 1] + Z;
+
+		return lerp(w, lerp(v, lerp(u, grad(p[AA], x, y, z), grad(p[BA], x - 1, y, z)),
+			lerp(u, grad(p[AB], x, y - 1, z), grad(p[BB], x - 1, y - 1, z))),
+			lerp(v, lerp(u, grad(p[AA + 1], x, y, z - 1), grad(p[BA + 1], x - 1, y, z - 1)),
+				lerp(u, grad(p[AB + 1], x, y - 1, z - 1), grad(p[BB + 1], x - 1, y - 1, z - 1))));
+	}
+
+	// ConstantY selects at compile time between one y for the whole batch (the terrain's 2D
+	// case) and a y per sample
+	template <bool ConstantY>
+	void evaluateBatch(const float* xs, const float* ys, float y, const float* zs, float* out, size_t count) const {
+		size_t i = 0;
+#ifdef __AVX2__
+		FixedY fixed = fixY(y);
+		for (; i + 8 <= count; i += 8) {
+			__m256 x = _mm256_loadu_ps(xs + i);
+			__m256 z = _mm256_loadu_ps(zs + i);
+			__m256 floorX = _mm256_floor_ps(x), floorZ = _mm256_floor_ps(z);
+			__m256i byteMask = _mm256_set1_epi32(255);
+			__m256i X = _mm256_and_si256(_mm256_cvttps_epi32(floorX), byteMask);
+			__m256i Z = _mm256_and_si256(_mm256_cvttps_epi32(floorZ), byteMask);
+			x = _mm256_sub_ps(x, floorX);
+			z = _mm256_sub_ps(z, floorZ);
+
+			__m256i Y;
+			__m256 fy, v;
+			if (ConstantY) {
+				Y = _mm256_set1_epi32(fixed.cell);
+				fy = _mm256_set1_ps(fixed.y);
+				v = _mm256_set1_ps(fixed.v);
+			}
+			else {
+				fy = _mm256_loadu_ps(ys + i);
+				__m256 floorY = _mm256_floor_ps(fy);
+				Y = _mm256_and_si256(_mm256_cvttps_epi32(floorY), byteMask);
+				fy = _mm256_sub_ps(fy, floorY);
+				v = fade8(fy);
+			}
+			__m256 u = fade8(x);
+			__m256 w = fade8(z);
+
+			// the hashes are looked up with scalar loads, gathers are slower on many CPUs
+			alignas(32) int cellX[8], cellY[8], cellZ[8];
+			alignas(32) int hashes[8][8];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(cellX), X);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(cellY), Y);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(cellZ), Z);
+			for (int lane = 0; lane < 8; ++lane) {
+				int A = p[cellX[lane]] + cellY[lane], AA = p[A] + cellZ[lane], AB = p[A + 1] + cellZ[lane];
+				int B = p[cellX[lane] + 1] + cellY[lane], BA = p[B] + cellZ[lane], BB = p[B + 1] + cellZ[lane];
+				hashes[0][lane] = p[AA];
+				hashes[1][lane] = p[BA];
+				hashes[2][lane] = p[AB];
+				hashes[3][lane] = p[BB];
+				hashes[4][lane] = p[AA + 1];
+				hashes[5][lane] = p[BA + 1];
+				hashes[6][lane] = p[AB + 1];
+				hashes[7][lane] = p[BB + 1];
+			}
+			auto hash = [&hashes](int corner) {
+				return _mm256_load_si256(reinterpret_cast<const __m256i*>(hashes[corner]));
+			};
+
+			__m256 ones = _mm256_set1_ps(1.0f);
+			__m256 x1 = _mm256_sub_ps(x, ones), y1 = _mm256_sub_ps(fy, ones), z1 = _mm256_sub_ps(z, ones);
+			__m256 front = lerp8(v,
+				lerp8(u, grad8(hash(0), x, fy, z), grad8(hash(1), x1, fy, z)),
+				lerp8(u, grad8(hash(2), x, y1, z), grad8(hash(3), x1, y1, z)));
+			__m256 back = lerp8(v,
+				lerp8(u, grad8(hash(4), x, fy, z1), grad8(hash(5), x1, fy, z1)),
+				lerp8(u, grad8(hash(6), x, y1, z1), grad8(hash(7), x1, y1, z1)));
+			_mm256_storeu_ps(out + i, lerp8(w, front, back));
+		}
+#endif
+		if (ConstantY) {
+			FixedY fixedTail = fixY(y);
+			for (; i < count; ++i)
+				out[i] = noiseFixedY(xs[i], fixedTail, zs[i]);
+		}
+		else {
+			for (; i < count; ++i)
+				out[i] = noise(xs[i], ys[i], zs[i]);
+		}
+	}
+
+#ifdef __AVX2__
+	static __m256 fade8(__m256 t) {
+		__m256 inner = _mm256_add_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(-15.0f));
+		inner = _mm256_add_ps(_mm256_mul_ps(t, inner), _mm256_set1_ps(10.0f));
+		return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+	}
+
+	static __m256 lerp8(__m256 t, __m256 a, __m256 b) {
+		return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+	}
+
+	static __m256 grad8(__m256i hash, __m256 x, __m256 y, __m256 z) {
+		__m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+		__m256 below8 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+		__m256 below4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+		__m256 is12or14 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(h, _mm256_set1_epi32(13)), _mm256_set1_epi32(12)));
+		__m256 u = _mm256_blendv_ps(y, x, below8);
+		__m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, is12or14), y, below4);
+		// bit 0 of the hash moves to the sign of u, bit 1 to the sign of v
+		__m256 signU = _mm256_castsi256_ps(_mm256_slli_epi32(h, 31));
+		__m256 signV = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_srli_epi32(h, 1), 31));
+		return _mm256_add_ps(_mm256_xor_ps(u, signU), _mm256_xor_ps(v, signV));
+	}
+#endif
+
+public:
+	explicit PerlinNoise(unsigned seed = std::default_random_engine::default_seed) {
+		std::vector<int> permutation(256);
+		std::iota(permutation.begin(), permutation.end(), 0);
+		std::shuffle(permutation.begin(), permutation.end(), std::default_random_engine(seed));
+
+		for (int i = 0; i < 512; ++i)
+			p[i] = static_cast<uint8_t>(permutation[i & 255]);
+	}
+
+	float noise(float x, float y, float z) const {
+		return noiseFixedY(x, fixY(y), z);
+	}
+
+	// out[i] = noise(xs[i], ys[i], zs[i])
+	void noiseBatch(const float* xs, const float* ys, const float* zs, float* out, size_t count) const {
+		evaluateBatch<false>(xs, ys, 0.0f, zs, out, count);
+	}
+
+	// out[i] = noise(xs[i], y, zs[i])
+	void noiseBatch(const float* xs, float y, const float* zs, float* out, size_t count) const {
+		evaluateBatch<true>(xs, nullptr, y, zs, out, count);
+	}
+
+	// The noise at one fixed y. With y fixed, each of the four (x, z) corners of a lattice cell
+	// contributes c + gx * x + gz * z after the lerp along y, x and z being the position inside
+	// the cell, so every cell keeps those 12 coefficients (3 MB) and a sample costs four
+	// multiply-adds and three lerps instead of eight gradients and seven lerps. The values equal
+	// PerlinNoise::noise up to float rounding. Building it takes a few milliseconds;
+	// it is immutable afterwards and may be shared between threads.
+	class Slice {
+	public:
+		Slice(const PerlinNoise& source, float y) : coefficients(256 * 256 * CELL_FLOATS) {
+			FixedY fixed = fixY(y);
+			const uint8_t* p = source.p;
+			// gradient components of the 16 hashes; grad() is linear in x, y and z
+			float gradX[16], gradY[16], gradZ[16];
+			for (int h = 0; h < 16; ++h) {
+				gradX[h] = grad(h, 1.0f, 0.0f, 0.0f);
+				gradY[h] = grad(h, 0.0f, 1.0f, 0.0f);
+				gradZ[h] = grad(h, 0.0f, 0.0f, 1.0f);
+			}
+			for (int X = 0; X < 256; ++X) {
+				int A = p[X] + fixed.cell, B = p[X + 1] + fixed.cell;
+				for (int Z = 0; Z < 256; ++Z) {
+					int AA = p[A] + Z, AB = p[A + 1] + Z;
+					int BA = p[B] + Z, BB = p[B + 1] + Z;
+					// corner (x, z) order 00, 10, 01, 11; hashes at the lower and the upper y
+					int lower[4] = { p[AA] & 15, p[BA] & 15, p[AA + 1] & 15, p[BA + 1] & 15 };
+					int upper[4] = { p[AB] & 15, p[BB] & 15, p[AB + 1] & 15, p[BB + 1] & 15 };
+					float* cell = &coefficients[(X << 8 | Z) * CELL_FLOATS];
+					for (int corner = 0; corner < 4; ++corner) {
+						float gx = lerp(fixed.v, gradX[lower[corner]], gradX[upper[corner]]);
+						float gz = lerp(fixed.v, gradZ[lower[corner]], gradZ[upper[corner]]);
+						float c = lerp(fixed.v, gradY[lower[corner]] * fixed.y, gradY[upper[corner]] * (fixed.y - 1.0f));
+						if (corner & 1)
+							c -= gx;
+						if (corner & 2)
+							c -= gz;
+						cell[corner * 3] = c;
+						cell[corner * 3 + 1] = gx;
+						cell[corner * 3 + 2] = gz;
+					}
+				}
+			}
+		}
+
+		float noise(float x, float z) const {
+			float floorX = std::floor(x), floorZ = std::floor(z);
+			const float* cell = &coefficients[(((int)floorX & 255) << 8 | ((int)floorZ & 255)) * CELL_FLOATS];
+			x -= floorX;
+			z -= floorZ;
+			float corner[4];
+			for (int k = 0; k < 4; ++k)
+				corner[k] = cell[k * 3] + cell[k * 3 + 1] * x + cell[k * 3 + 2] * z;
+			float u = fade(x);
+			return lerp(fade(z), lerp(u, corner[0], corner[1]), lerp(u, corner[2], corner[3]));
+		}
+
+		// out[i] = noise(xs[i], zs[i])
+		void noiseBatch(const float* xs, const float* zs, float* out, size_t count) const {
+			size_t i = 0;
+#ifdef __AVX2__
+			const float* table = coefficients.data();
+			__m256i byteMask = _mm256_set1_epi32(255);
+			for (; i + 8 <= count; i += 8) {
+				__m256 x = _mm256_loadu_ps(xs + i);
+				__m256 z = _mm256_loadu_ps(zs + i);
+				__m256 floorX = _mm256_floor_ps(x), floorZ = _mm256_floor_ps(z);
+				__m256i X = _mm256_and_si256(_mm256_cvttps_epi32(floorX), byteMask);
+				__m256i Z = _mm256_and_si256(_mm256_cvttps_epi32(floorZ), byteMask);
+				x = _mm256_sub_ps(x, floorX);
+				z = _mm256_sub_ps(z, floorZ);
+				__m256i cells = _mm256_or_si256(_mm256_slli_epi32(X, 8), Z);
+
+				// neighbouring terrain samples mostly fall into one or two cells: then the
+				// coefficients of those cells are broadcast and blended, otherwise every lane
+				// gathers its own
+				int firstCell = _mm256_extract_epi32(cells, 0), lastCell = _mm256_extract_epi32(cells, 7);
+				__m256i inFirst = _mm256_cmpeq_epi32(cells, _mm256_set1_epi32(firstCell));
+				__m256i inLast = _mm256_cmpeq_epi32(cells, _mm256_set1_epi32(lastCell));
+				bool oneCell = _mm256_movemask_epi8(inFirst) == -1;
+				bool twoCells = _mm256_movemask_epi8(_mm256_or_si256(inFirst, inLast)) == -1;
+				__m256 lastMask = _mm256_castsi256_ps(_mm256_andnot_si256(inFirst, inLast));
+				const float* first = table + firstCell * CELL_FLOATS;
+				const float* last = table + lastCell * CELL_FLOATS;
+				__m256i offsets = _mm256_mullo_epi32(cells, _mm256_set1_epi32(CELL_FLOATS));
+				auto coefficient = [&](int index) {
+					if (oneCell)
+						return _mm256_broadcast_ss(first + index);
+					if (twoCells)
+						return _mm256_blendv_ps(_mm256_broadcast_ss(first + index), _mm256_broadcast_ss(last + index), lastMask);
+					return _mm256_i32gather_ps(table + index, offsets, 4);
+				};
+
+				__m256 corner[4];
+				for (int k = 0; k < 4; ++k)
+					corner[k] = _mm256_add_ps(_mm256_add_ps(coefficient(k * 3), _mm256_mul_ps(coefficient(k * 3 + 1), x)),
+						_mm256_mul_ps(coefficient(k * 3 + 2), z));
+				__m256 u = fade8(x);
+				_mm256_storeu_ps(out + i, lerp8(fade8(z), lerp8(u, corner[0], corner[1]), lerp8(u, corner[2], corner[3])));
+			}
+#endif
+			for (; i < count; ++i)
+				out[i] = noise(xs[i], zs[i]);
+		}
+
+	private:
+		static const int CELL_FLOATS = 12;
+		std::vector<float> coefficients;
+	};
+};
+
+enum class TerrainNoiseMode : int32_t {
+	// one octave of Perlin noise
+	Perlin = 0,
+	// fractional Brownian motion: octaves of rising frequency and falling amplitude
+	Fbm = 1,
+	// ridged multifractal: sharp crests where the noise crosses zero, rougher on high ground
+	Ridged = 2,
+	// fBm sampled at coordinates displaced by two other fBm fields
+	DomainWarp = 3,
+};
+
+// Everything the generated terrain depends on; cached tiles are only reused for the same values
+// (see hashTerrainParams).
+struct TerrainParams {
+	uint32_t seed = std::default_random_engine::default_seed;
+	float size = 10.0f;
+	int32_t resolution = 10;
+	float frequency = 0.05f;
+	float heightScale = 30.0f;
+	// added to the noise coordinates, y picks the slice of the 3D noise
+	glm::vec3 offset = glm::vec3(0.0f, 1.0f, 0.0f);
+
+	TerrainNoiseMode mode = TerrainNoiseMode::Perlin;
+	// octave settings of the fBm, ridged and domain warp modes
+	int32_t octaves = 6;
+	float lacunarity = 2.0f;
+	float gain = 0.5f;
+	// how far domain warping moves a sample, in noise units
+	float warpStrength = 1.5f;
+};
+
+inline uint64_t hashTerrainParams(const TerrainParams& terrainParams) {
+	// hashed field by field, the struct may have padding
+	unsigned char bytes[sizeof(uint32_t) + 3 * sizeof(int32_t) + 9 * sizeof(float)];
+	unsigned char* out = bytes;
+	auto put = [&out](const void* value, size_t size) {
+		std::memcpy(out, value, size);
+		out += size;
+	};
+	put(&terrainParams.seed, sizeof(uint32_t));
+	put(&terrainParams.size, sizeof(float));
+	put(&terrainParams.resolution, sizeof(int32_t));
+	put(&terrainParams.frequency, sizeof(float));
+	put(&terrainParams.heightScale, sizeof(float));
+	put(glm::value_ptr(terrainParams.offset), 3 * sizeof(float));
+	int32_t mode = static_cast<int32_t>(terrainParams.mode);
+	put(&mode, sizeof(int32_t));
+	put(&terrainParams.octaves, sizeof(int32_t));
+	put(&terrainParams.lacunarity, sizeof(float));
+	put(&terrainParams.gain, sizeof(float));
+	put(&terrainParams.warpStrength, sizeof(float));
+	return Core::HashBytes(bytes, sizeof(bytes));
+}
+
+// Maps "perlin", "fbm", "ridged" or "warp" to a mode; false for anything else.
+inline bool parseTerrainNoiseMode(const std::string& name, TerrainNoiseMode& mode) {
+	static const std::pair<const char*, TerrainNoiseMode> names[] = {
+		{ "perlin", TerrainNoiseMode::Perlin },
+		{ "fbm", TerrainNoiseMode::Fbm },
+		{ "ridged", TerrainNoiseMode::Ridged },
+		{ "warp", TerrainNoiseMode::DomainWarp },
+	};
+	for (const auto& entry : names) {
+		if (name == entry.first) {
+			mode = entry.second;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Terrain noise of the selected mode in [-1, 1], evaluated on arrays of noise-space (x, z)
+// points. All octaves read the same PerlinNoise::Slice; each octave is shifted so the lattice
+// zeros of the octaves do not line up. Immutable once built, so threads may share it.
+class TerrainNoise {
+public:
+	explicit TerrainNoise(const TerrainParams& terrainParams)
+		: params(terrainParams), perlin(terrainParams.seed), slice(perlin, terrainParams.offset.y) {
+	}
+
+	void evaluate(const float* xs, const float* zs, float* out, size_t count) const {
+		switch (params.mode) {
+		case TerrainNoiseMode::Perlin:
+			slice.noiseBatch(xs, zs, out, count);
+			break;
+		case TerrainNoiseMode::Fbm:
+			fbm(xs, zs, out, count);
+			break;
+		case TerrainNoiseMode::Ridged:
+			ridged(xs, zs, out, count);
+			break;
+		case TerrainNoiseMode::DomainWarp:
+			domainWarp(xs, zs, out, count);
+			break;
+		}
+	}
+
+private:
+	TerrainParams params;
+	PerlinNoise perlin;
+	PerlinNoise::Slice slice;
+
+	static glm::vec2 octaveShift(int octave) {
+		return glm::vec2(19.19f, 7.73f) * static_cast<float>(octave);
+	}
+
+	// fills octaveX/octaveZ with the coordinates of one octave and evaluates it into value
+	void octave(const float* xs, const float* zs, size_t count, int index, float scale,
+		std::vector<float>& octaveX, std::vector<float>& octaveZ, std::vector<float>& value) const {
+		glm::vec2 shift = octaveShift(index);
+		for (size_t i = 0; i < count; ++i) {
+			octaveX[i] = xs[i] * scale + shift.x;
+			octaveZ[i] = zs[i] * scale + shift.y;
+		}
+		slice.noiseBatch(octaveX.data(), octaveZ.data(), value.data(), count);
+	}
+
+	void fbm(const float* xs, const float* zs, float* out, size_t count) const {
+		std::vector<float> octaveX(count), octaveZ(count), value(count);
+		std::fill(out, out + count, 0.0f);
+		float amplitude = 1.0f, scale = 1.0f, amplitudeSum = 0.0f;
+		for (int o = 0; o < params.octaves; ++o) {
+			octave(xs, zs, count, o, scale, octaveX, octaveZ, value);
+			for (size_t i = 0; i < count; ++i)
+				out[i] += value[i] * amplitude;
+			amplitudeSum += amplitude;
+			amplitude *= params.gain;
+			scale *= params.lacunarity;
+		}
+		for (size_t i = 0; i < count; ++i)
+			out[i] /= amplitudeSum;
+	}
+
+	// Musgrave's ridged multifractal: every octave is weighted by the signal of the one before,
+	// so the detail gathers on the ridges
+	void ridged(const float* xs, const float* zs, float* out, size_t count) const {
+		std::vector<float> octaveX(count), octaveZ(count), value(count), weight(count, 1.0f);
+		std::fill(out, out + count, 0.0f);
+		float amplitude = 1.0f, scale = 1.0f, amplitudeSum = 0.0f;
+		for (int o = 0; o < params.octaves; ++o) {
+			octave(xs, zs, count, o, scale, octaveX, octaveZ, value);
+			for (size_t i = 0; i < count; ++i) {
+				float signal = 1.0f - std::abs(value[i]);
+				signal *= signal * weight[i];
+				weight[i] = glm::clamp(signal * 2.0f, 0.0f, 1.0f);
+				out[i] += signal * amplitude;
+			}
+			amplitudeSum += amplitude;
+			amplitude *= params.gain;
+			scale *= params.lacunarity;
+		}
+		for (size_t i = 0; i < count; ++i)
+			out[i] = out[i] / amplitudeSum * 2.0f - 1.0f;
+	}
+
+	void domainWarp(const float* xs, const float* zs, float* out, size_t count) const {
+		std::vector<float> shiftedX(count), shiftedZ(count), warpX(count), warpZ(count);
+		for (size_t i = 0; i < count; ++i) {
+			shiftedX[i] = xs[i] + 5.2f;
+			shiftedZ[i] = zs[i] + 1.3f;
+		}
+		fbm(shiftedX.data(), shiftedZ.data(), warpX.data(), count);
+		for (size_t i = 0; i < count; ++i) {
+			shiftedX[i] = xs[i] + 1.7f;
+			shiftedZ[i] = zs[i] + 9.2f;
+		}
+		fbm(shiftedX.data(), shiftedZ.data(), warpZ.data(), count);
+		for (size_t i = 0; i < count; ++i) {
+			shiftedX[i] = xs[i] + params.warpStrength * warpX[i];
+			shiftedZ[i] = zs[i] + params.warpStrength * warpZ[i];
+		}
+		fbm(shiftedX.data(), shiftedZ.data(), out, count);
+	}
+};
+
+// Terrain heights on the lattice of sample points (i / resolution * size - size / 2) in both
+// axes, extended past the patch in every direction. Heights are computed a tile of
+// TILE_QUADS x TILE_QUADS quads at a time, on first request, and kept until trim() drops the
+// least recently used ones; a tile holds its border samples too, so neighbouring tiles repeat
+// one row or column. Safe to use from several threads: a tile is computed outside the lock by
+// the first thread that asks for it, and the others asking meanwhile wait for that copy.
+// Tiles are handed out as shared pointers, so trimming never frees a tile still in use.
+// With a cache directory every computed tile is also written there, one file per tile named
+// after the params hash and the tile coordinates, and a tile missing from memory is read back
+// from its file before it is computed again.
+class TerrainTileCache {
+public:
+	static const int TILE_QUADS = 64;
+	static const int TILE_SAMPLES = TILE_QUADS + 1;
+
+	struct Tile {
+		int tileX;
+		int tileZ;
+		// TILE_SAMPLES rows of TILE_SAMPLES heights, x along a row
+		std::vector<float> heights;
+		float heightMin;
+		float heightMax;
+
+		float height(int localX, int localZ) const {
+			return heights[static_cast<size_t>(localZ) * TILE_SAMPLES + localX];
+		}
+	};
+
+	// An empty cacheDirectory keeps the tiles in memory only; regenerate ignores the tile files
+	// already there (and overwrites them).
+	explicit TerrainTileCache(const TerrainParams& terrainParams, const std::string& cacheDirectory = "", bool regenerate = false)
+		: params(terrainParams), noise(terrainParams), paramsHash(hashTerrainParams(terrainParams)),
+		cacheDirectory(cacheDirectory), regenerate(regenerate) {
+		if (!cacheDirectory.empty())
+			Core::MakeDirectory(cacheDirectory);
+	}
+
+	// The tile if it is in memory, nullptr otherwise; never reads files or computes.
+	std::shared_ptr<const Tile> find(int tileX, int tileZ) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = tiles.find(std::pair<int, int>(tileX, tileZ));
+		if (found == tiles.end())
+			return nullptr;
+		found->second.lastUse = ++useCounter;
+		return found->second.tile;
+	}
+
+	std::shared_ptr<const Tile> tile(int tileX, int tileZ) {
+		std::pair<int, int> key(tileX, tileZ);
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			for (;;) {
+				auto found = tiles.find(key);
+				if (found != tiles.end()) {
+					found->second.lastUse = ++useCounter;
+					return found->second.tile;
+				}
+				// one thread reads or computes (and writes) each tile, the others wait for it
+				if (inFlight.insert(key).second)
+					break;
+				tileStored.wait(lock);
+			}
+		}
+		std::shared_ptr<const Tile> computed;
+		if (!cacheDirectory.empty() && !regenerate)
+			computed = readTile(tileX, tileZ);
+		if (!computed) {
+			computed = computeTile(tileX, tileZ);
+			if (!cacheDirectory.empty())
+				writeTile(*computed);
+		}
+		std::shared_ptr<const Tile> stored;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Entry& entry = tiles.emplace(key, Entry{ computed, 0 }).first->second;
+			entry.lastUse = ++useCounter;
+			stored = entry.tile;
+			inFlight.erase(key);
+		}
+		tileStored.notify_all();
+		return stored;
+	}
+
+	// Drops the least recently used tiles until at most maxTiles are left.
+	void trim(size_t maxTiles) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (tiles.size() <= maxTiles)
+			return;
+		std::vector<std::pair<uint64_t, std::pair<int, int>>> byUse;
+		byUse.reserve(tiles.size());
+		for (const auto& tile : tiles)
+			byUse.push_back({ tile.second.lastUse, tile.first });
+		size_t dropCount = tiles.size() - maxTiles;
+		std::nth_element(byUse.begin(), byUse.begin() + dropCount, byUse.end());
+		for (size_t i = 0; i < dropCount; ++i)
+			tiles.erase(byUse[i].second);
+	}
+
+	// height of lattice sample (x, z); sample (0, 0) is the patch corner
+	float sampleHeight(int x, int z) {
+		int tileX = floorDiv(x, TILE_QUADS), tileZ = floorDiv(z, TILE_QUADS);
+		return tile(tileX, tileZ)->height(x - tileX * TILE_QUADS, z - tileZ * TILE_QUADS);
+	}
+
+	size_t tileCount() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return tiles.size();
+	}
+
+	static int floorDiv(int value, int divisor) {
+		return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+	}
+
+private:
+	static const uint32_t CACHE_MAGIC = 0x4C545447; // "GTTL"
+	static const uint32_t CACHE_VERSION = 2;
+
+	// Header of a tile file, followed by the TILE_SAMPLES^2 float heights in row order.
+	struct TileFileHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t paramsHash;
+		int32_t tileX;
+		int32_t tileZ;
+		float heightMin;
+		float heightMax;
+	};
+
+	TerrainParams params;
+	TerrainNoise noise;
+	uint64_t paramsHash;
+	std::string cacheDirectory;
+	bool regenerate;
+
+	struct Entry {
+		std::shared_ptr<const Tile> tile;
+		uint64_t lastUse;
+	};
+
+	std::mutex mutex;
+	std::map<std::pair<int, int>, Entry> tiles;
+	// tiles some thread is reading or computing right now; others wait on tileStored for them
+	std::set<std::pair<int, int>> inFlight;
+	std::condition_variable tileStored;
+	uint64_t useCounter = 0;
+
+	float samplePosition(int index) const {
+		return (index / static_cast<float>(params.resolution)) * params.size - (params.size / 2.0f);
+	}
+
+	std::string tilePath(int tileX, int tileZ) const {
+		char name[80];
+		std::snprintf(name, sizeof(name), "terrain_%016llx_%d_%d.terraincache", (unsigned long long)paramsHash, tileX, tileZ);
+		return cacheDirectory + name;
+	}
+
+	std::shared_ptr<const Tile> readTile(int tileX, int tileZ) const {
+		STARTUP_PHASE("Terrain tile cache read");
+		size_t sampleCount = static_cast<size_t>(TILE_SAMPLES) * TILE_SAMPLES;
+		Core::MappedFile file(tilePath(tileX, tileZ));
+		if (!file.isOpen() || file.size() != sizeof(TileFileHeader) + sampleCount * sizeof(float))
+			return nullptr;
+		TileFileHeader header;
+		std::memcpy(&header, file.data(), sizeof(header));
+		if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.paramsHash != paramsHash
+			|| header.tileX != tileX || header.tileZ != tileZ)
+			return nullptr;
+
+		std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+		tile->tileX = tileX;
+		tile->tileZ = tileZ;
+		tile->heightMin = header.heightMin;
+		tile->heightMax = header.heightMax;
+		tile->heights.resize(sampleCount);
+		std::memcpy(tile->heights.data(), file.data() + sizeof(header), sampleCount * sizeof(float));
+		return tile;
+	}
+
+	void writeTile(const Tile& tile) const {
+		TileFileHeader header;
+		header.magic = CACHE_MAGIC;
+		header.version = CACHE_VERSION;
+		header.paramsHash = paramsHash;
+		header.tileX = tile.tileX;
+		header.tileZ = tile.tileZ;
+		header.heightMin = tile.heightMin;
+		header.heightMax = tile.heightMax;
+
+		// written under a temporary name so a crash never leaves a half-written tile behind
+		std::string cachePath = tilePath(tile.tileX, tile.tileZ);
+		std::string temporaryPath = cachePath + ".tmp";
+		{
+			std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+			if (!out) {
+				std::cout << "cannot write terrain cache " << cachePath << std::endl;
+				return;
+			}
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(tile.heights.data()), tile.heights.size() * sizeof(float));
+			if (!out) {
+				std::cout << "cannot write terrain cache " << cachePath << std::endl;
+				out.close();
+				std::remove(temporaryPath.c_str());
+				return;
+			}
+		}
+		std::remove(cachePath.c_str());
+		std::rename(temporaryPath.c_str(), cachePath.c_str());
+	}
+
+	std::shared_ptr<const Tile> computeTile(int tileX, int tileZ) const {
+		STARTUP_PHASE("Terrain tile generation");
+		std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+		tile->tileX = tileX;
+		tile->tileZ = tileZ;
+		size_t sampleCount = static_cast<size_t>(TILE_SAMPLES) * TILE_SAMPLES;
+		std::vector<float> noiseX(sampleCount), noiseZ(sampleCount);
+		for (int z = 0; z < TILE_SAMPLES; ++z) {
+			float noiseRowZ = samplePosition(tileZ * TILE_QUADS + z) * params.frequency + params.offset.z;
+			for (int x = 0; x < TILE_SAMPLES; ++x) {
+				noiseX[z * TILE_SAMPLES + x] = samplePosition(tileX * TILE_QUADS + x) * params.frequency + params.offset.x;
+				noiseZ[z * TILE_SAMPLES + x] = noiseRowZ;
+			}
+		}
+
+		// all octaves of the tile are summed here once, later queries only read the result
+		tile->heights.resize(sampleCount);
+		noise.evaluate(noiseX.data(), noiseZ.data(), tile->heights.data(), sampleCount);
+		tile->heightMin = std::numeric_limits<float>::max();
+		tile->heightMax = -std::numeric_limits<float>::max();
+		for (float& height : tile->heights) {
+			height = (height + 1.0f) / 2.0f * params.heightScale;
+			tile->heightMin = std::min(tile->heightMin, height);
+			tile->heightMax = std::max(tile->heightMax, height);
+		}
+		return tile;
+	}
+};
+
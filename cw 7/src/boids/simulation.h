@@ -5,6 +5,9 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
+#include "../rendering/RenderQueue.h"
+#include "../profiling/GpuProfiler.h"
+
 glm::vec3 lightPos(-100.0f, 40.0f, 100.0f);
 glm::vec3 lightColor(1.0f, 1.0f, 1.0f);
 
@@ -47,11 +50,18 @@ void initWidget(GLFWwindow* window) {
     ImGui_ImplOpenGL3_Init("#version 410");
 }
 
-void drawSliderWidget(SimulationParams* params) {
+void beginWidgetFrame() {
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
+}
+
+void endWidgetFrame() {
+    ImGui::Render();
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+}
 
+void drawSliderWidget(SimulationParams* params) {
     ImGui::Begin("Boid Parameters");
 
     ImGui::SliderFloat("Avoid Force", &params->avoidForce, 0.1f, 5.0f);
@@ -63,9 +73,41 @@ void drawSliderWidget(SimulationParams* params) {
     ImGui::SliderFloat("Delta Time", &params->deltaTime, 0.0f, 0.1f);
 
     ImGui::End();
+}
 
-    ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+void drawRenderStatsWidget(const RenderQueueStats& stats) {
+    ImGui::Begin("Render Stats");
+
+    ImGui::Text("Draw calls: %d", stats.drawCalls);
+    ImGui::Text("Program changes: %d", stats.programChanges);
+    ImGui::Text("VAO changes: %d", stats.vertexArrayChanges);
+    ImGui::Text("Texture changes: %d", stats.textureChanges);
+    ImGui::Text("Depth state changes: %d", stats.depthStateChanges);
+    ImGui::Text("Skipped redundant changes: %d", stats.skippedStateChanges);
+
+    ImGui::End();
+}
+
+void drawGpuProfilerWidget(GpuProfiler& profiler) {
+    ImGui::Begin("GPU Timings");
+
+    ImGui::Checkbox("Enabled", &profiler.enabled);
+
+    bool logging = profiler.isLogging();
+    if (ImGui::Checkbox("Log to gpu_timings.csv", &logging)) {
+        if (logging)
+            profiler.startCsvLog("gpu_timings.csv");
+        else
+            profiler.stopCsvLog();
+    }
+
+    if (profiler.enabled) {
+        ImGui::Text("%-14s %8s %8s %8s", "Pass", "last", "avg", "p99");
+        for (const GpuPassStats& pass : profiler.getStats())
+            ImGui::Text("%-14s %8.3f %8.3f %8.3f", pass.name.c_str(), pass.lastMs, pass.averageMs, pass.p99Ms);
+    }
+
+    ImGui::End();
 }
 
 void destroyWidget() {
@@ -7,6 +7,8 @@
 
 #include "Shader_Loader.h"
 #include "Render_Utils.h"
+#include "Mesh_Cache.h"
+#include "Mapped_File.h"
 #include "Texture.h"
 
 #include "Box.cpp"
@@ -21,7 +23,15 @@
 #include "boids/vertices.h"
 #include "boids/Terrain.h"
 #include "boids/Boid.h"
+#include "rendering/CascadedShadowMap.h"
+#include "rendering/RenderQueue.h"
+#include "rendering/FrameGraph.h"
 #include "utils.h"
+#include "options.h"
+#include "profiling/CpuProfiler.h"
+#include "profiling/StartupReport.h"
+#include "loading/AssetLoader.h"
+#include "loading/TextureStreamer.h"
 
 #include <random>
 #include <numeric>
@@ -32,6 +42,7 @@ bool wireframeOnlyView = false;
 bool key1WasPressed = false;
 bool key2WasPressed = false;
 bool key3WasPressed = false;
+bool f9WasPressed = false;
 bool cursorEnabled = false;
 bool showBoundingBox = false;
 
@@ -39,8 +50,7 @@ SimulationParams simulationParams;
 
 glm::vec3 cameraPos = glm::vec3(-15.f, 0, 0);
 glm::vec3 cameraDir = glm::vec3(1.f, 0.f, 0.f);
-GLuint boidTextureID;
-GLuint gradientTextures[10];
+GLuint gradientTextureArray;
 
 float yaw = 0.0f;
 float pitch = 0.0f;
@@ -120,29 +130,36 @@ ProceduralTerrain* terrain;
 GLuint boidVAO, boidVBO;
 GLuint boundingBoxVAO, boundingBoxVBO, boundingBoxEBO;
 
-GLuint boidShader, basicBoidShader, boundBoxShader, terrainShader, basicTerrainShader, depthShader;
+GLuint boidShader, basicBoidShader, boundBoxShader, terrainShader, basicTerrainShader, depthShader, boidDepthShader, impostorShader, impostorBakeShader;
 GLuint activeBoidShader; 
 GLuint activeTerrainShader;
 
 Flock flock;
 
-GLuint modelLoc;
-GLuint viewLoc;
-GLuint projectionLoc;
-
-GLuint terrainProjectionLoc, terrainViewLoc, terrainModelLoc, terrainColorLoc;
 GLuint terrainTexture, terrainNormal;
 
 GLuint skyboxTexture;
 GLuint skyboxShader;
 Core::RenderContext skyboxCube;
 
-GLuint depthMapFBO, depthMap;
-const GLuint SHADOW_WIDTH = 1024 * 4, SHADOW_HEIGHT = 1024 * 4;
-
-glm::mat4 lightProjection;
-glm::mat4 lightView;
-glm::mat4 lightSpaceMatrix;
+CascadedShadowMap shadowMap(4, 1024);
+RenderQueue renderQueue;
+GpuProfiler gpuProfiler;
+FrameGraph frameGraph;
+RunOptions runOptions;
+// framebuffer the scene is drawn into, 0 is the window; the render benchmark swaps in an FBO
+GLuint sceneFramebuffer = 0;
+
+AssetLoader assetLoader;
+// GL time per frame given to finished asset loads
+double assetUploadBudgetMs = 2.0;
+// copies finished textures to the GPU over several frames, placeholders are bound until then
+TextureStreamer textureStreamer;
+// the flock needs the bird mesh and the gradient textures, it is created once both have arrived
+bool flockReady = false;
+
+const float cameraNear = 0.05f;
+const float cameraFar = 1000.0f;
 
 std::vector<std::string> skyboxFaces = {
 	"./textures/skybox/clouds/clouds1_east.bmp",
@@ -154,34 +171,6 @@ std::vector<std::string> skyboxFaces = {
 };
 
 
-GLuint loadCubemap(const std::vector<std::string>& faces) {
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-	int width, height, nrChannels;
-	for (size_t i = 0; i < faces.size(); i++) {
-		unsigned char* data = SOIL_load_image(faces[i].c_str(), &width, &height, &nrChannels, SOIL_LOAD_RGBA);
-		if (data) {
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-			std::cout << "Loaded: " << faces[i] << std::endl;
-		}
-		else {
-			std::cerr << "Failed to load: " << faces[i] << std::endl;
-		}
-		SOIL_free_image_data(data);
-	}
-
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	return textureID;
-}
-
-
 glm::mat4 createCameraMatrix()
 {
 	glm::vec3 cameraSide = glm::normalize(glm::cross(cameraDir, glm::vec3(0.f, 1.f, 0.f)));
@@ -201,8 +190,8 @@ glm::mat4 createCameraMatrix()
 glm::mat4 createPerspectiveMatrix()
 {
 	glm::mat4 perspectiveMatrix;
-	float n = 0.05;
-	float f = 1000.;
+	float n = cameraNear;
+	float f = cameraFar;
 	float a1 = glm::min(aspectRatio, 1.f);
 	float a2 = glm::min(1 / aspectRatio, 1.f);
 	perspectiveMatrix = glm::mat4({
@@ -219,6 +208,7 @@ glm::mat4 createPerspectiveMatrix()
 
 void drawObjectColor(Core::RenderContext& context, glm::mat4 modelMatrix, glm::vec3 color) {
 
+	shaderLoader.PrepareProgram(program);
 	glUseProgram(program);
 	glm::mat4 viewProjectionMatrix = createPerspectiveMatrix() * createCameraMatrix();
 	glm::mat4 transformation = viewProjectionMatrix * modelMatrix;
@@ -226,11 +216,13 @@ void drawObjectColor(Core::RenderContext& context, glm::mat4 modelMatrix, glm::v
 	glUniformMatrix4fv(glGetUniformLocation(program, "modelMatrix"), 1, GL_FALSE, (float*)&modelMatrix);
 	glUniform3f(glGetUniformLocation(program, "color"), color.x, color.y, color.z);
 	glUniform3f(glGetUniformLocation(program, "lightPos"), 0, 0, 0);
+	glBindVertexArray(Core::GetMeshPool().vertexArray);
 	Core::DrawContext(context);
 
 }
 
 void drawObjectTexture(Core::RenderContext& context, glm::mat4 modelMatrix, GLuint textureID) {
+	shaderLoader.PrepareProgram(programTex);
 	glUseProgram(programTex);
 	glm::mat4 viewProjectionMatrix = createPerspectiveMatrix() * createCameraMatrix();
 	glm::mat4 transformation = viewProjectionMatrix * modelMatrix;
@@ -238,89 +230,132 @@ void drawObjectTexture(Core::RenderContext& context, glm::mat4 modelMatrix, GLui
 	glUniformMatrix4fv(glGetUniformLocation(programTex, "modelMatrix"), 1, GL_FALSE, (float*)&modelMatrix);
 	glUniform3f(glGetUniformLocation(programTex, "lightPos"), 0, 0, 0);
 	Core::SetActiveTexture(textureID, "colorTexture", programTex, 0);
+	glBindVertexArray(Core::GetMeshPool().vertexArray);
 	Core::DrawContext(context);
 }
 
 
-void drawSkybox() {
-	glDepthFunc(GL_LEQUAL);
-	glDepthMask(GL_FALSE);
-	glUseProgram(skyboxShader);
-
-	glm::mat4 viewProjectionMatrix = createPerspectiveMatrix() * glm::mat4(glm::mat3(createCameraMatrix()));
-	glUniformMatrix4fv(glGetUniformLocation(skyboxShader, "viewProjection"), 1, GL_FALSE, &viewProjectionMatrix[0][0]);
-
-	glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-	Core::DrawContext(skyboxCube);
-
-	glDepthMask(GL_TRUE);
-	glUseProgram(0);
+void submitSkybox(RenderQueue& queue, const glm::mat4& view, const glm::mat4& projection) {
+	DrawItem item;
+	item.layer = RenderLayer::Background;
+	item.depthState = DepthState::Background;
+	item.program = skyboxShader;
+	item.vertexArray = Core::GetMeshPool().vertexArray;
+	item.textures[0] = { GL_TEXTURE_CUBE_MAP, skyboxTexture };
+	item.firstIndex = skyboxCube.firstIndex;
+	item.baseVertex = skyboxCube.baseVertex;
+	item.count = skyboxCube.size;
+	item.passName = "Skybox";
+
+	glm::mat4 viewProjectionMatrix = projection * glm::mat4(glm::mat3(view));
+	item.setUniforms = [viewProjectionMatrix](GLuint program) {
+		glUniformMatrix4fv(glGetUniformLocation(program, "viewProjection"), 1, GL_FALSE, &viewProjectionMatrix[0][0]);
+	};
+	queue.submit(std::move(item));
 }
 
-void initShadowMap() {
-	glGenFramebuffers(1, &depthMapFBO);
-	glGenTextures(1, &depthMap);
-
-	glBindTexture(GL_TEXTURE_2D, depthMap);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-
-	float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void renderShadowDepth(GLuint depthArray) {
+	CPU_ZONE("Shadow pass");
+	shadowMap.beginDepthPass(depthArray);
+	if (terrain)
+		terrain->submitDepth(renderQueue, depthShader, glm::mat4(1.0f), shadowMap);
+	if (flockReady)
+		flock.submitDepth(renderQueue, boidDepthShader, shadowMap);
+	renderQueue.flush();
 }
 
-void captureShadowDepth(GLFWwindow* window) {
-	glm::mat4 lightProjection = glm::ortho(-200.0f, 200.0f, -200.0f, 200.0f, 0.1f, 400.0f);
-	lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
-	lightSpaceMatrix = lightProjection * lightView;
-
-	glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-	glClear(GL_DEPTH_BUFFER_BIT);
-
-	glUseProgram(depthShader);
-	glUniformMatrix4fv(glGetUniformLocation(depthShader, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-
-	terrain->render(depthShader, lightProjection, lightView, glm::mat4(1.0f), 0, 0, 0, cameraPos, lightPos, lightSpaceMatrix);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void bindSceneTarget(GLFWwindow* window) {
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
 
 	int width, height;
 	glfwGetFramebufferSize(window, &width, &height);
 	glViewport(0, 0, width, height);
+	glClearColor(0.1f, 0.3f, 0.6f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
 void renderScene(GLFWwindow* window)
 {
-	glClearColor(0.1f, 0.3f, 0.6f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	float time = glfwGetTime();
+	CPU_ZONE("renderScene");
 
 	glm::mat4 projection = createPerspectiveMatrix();
 	glm::mat4 view = createCameraMatrix();
 
-	captureShadowDepth(window);
-	drawSkybox();
+	renderQueue.beginFrame();
+	gpuProfiler.beginFrame();
+
+	shadowMap.update(view, projection, cameraNear, cameraFar, glm::vec3(0.0f) - lightPos);
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	if (flockReady)
+		flock.updateInstances(shadowMap, cameraPos, projection[1][1] * framebufferHeight * 0.5f);
+
+	frameGraph.reset();
+	FrameGraph::ResourceHandle shadowDepth = frameGraph.createTransient("Shadow depth", shadowMap.depthTargetDesc());
+	FrameGraph::ResourceHandle sceneColor = frameGraph.importResource("Scene color");
+	FrameGraph::ResourceHandle sceneDepth = frameGraph.importResource("Scene depth");
+	frameGraph.markOutput(sceneColor);
+
+	// only the full terrain shader samples the shadow map, without it the shadow pass is culled
+	bool shadowsVisible = terrain && activeTerrainShader == terrainShader;
+
+	frameGraph.addPass("Shadow",
+		[&](FrameGraph::PassBuilder& pass) {
+			pass.write(shadowDepth);
+		},
+		[&](const FrameGraph& graph) {
+			renderShadowDepth(graph.getTexture(shadowDepth));
+		});
 
-	if (showBoundingBox)
-		drawBoundingBox(view, projection, boundBoxShader, boundingBoxVAO);
-	
-	flock.draw(activeBoidShader, modelLoc, view, projection, viewLoc, projectionLoc, cameraPos);
+	frameGraph.addPass("Opaque",
+		[&](FrameGraph::PassBuilder& pass) {
+			if (shadowsVisible)
+				pass.read(shadowDepth);
+			pass.write(sceneColor);
+			pass.write(sceneDepth);
+		},
+		[&](const FrameGraph&) {
+			CPU_ZONE("Draw submission");
+			bindSceneTarget(window);
 
-	if (terrain)
-		terrain->render(activeTerrainShader, projection, view, glm::mat4(1.0f), terrainTexture, terrainNormal, depthMap, cameraPos, lightPos, lightSpaceMatrix);
+			if (showBoundingBox)
+				submitBoundingBox(renderQueue, view, projection, boundBoxShader, boundingBoxVAO);
+
+			if (flockReady)
+				flock.submit(renderQueue, activeBoidShader, impostorShader, view, projection, cameraPos);
+
+			if (terrain)
+				terrain->submit(renderQueue, activeTerrainShader, projection, view, glm::mat4(1.0f), terrainTexture, terrainNormal, shadowMap, cameraPos, lightPos);
+
+			renderQueue.flush();
+		});
+
+	frameGraph.addPass("Skybox",
+		[&](FrameGraph::PassBuilder& pass) {
+			pass.read(sceneDepth);
+			pass.write(sceneColor);
+		},
+		[&](const FrameGraph&) {
+			submitSkybox(renderQueue, view, projection);
+			renderQueue.flush();
+		});
+
+	frameGraph.addPass("UI",
+		[&](FrameGraph::PassBuilder& pass) {
+			pass.write(sceneColor);
+		},
+		[&](const FrameGraph&) {
+			CPU_ZONE("UI");
+			beginWidgetFrame();
+			drawSliderWidget(&simulationParams);
+			drawRenderStatsWidget(renderQueue.lastFrameStats);
+			drawGpuProfilerWidget(gpuProfiler);
+			GpuScope scope(gpuProfiler, "ImGui");
+			endWidgetFrame();
+		});
 
-	drawSliderWidget(&simulationParams);
+	frameGraph.compile();
+	frameGraph.execute();
 
 	glUseProgram(0);
 	glfwSwapBuffers(window);
@@ -332,28 +367,84 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	glViewport(0, 0, width, height);
 }
 
-void loadModelToContext(std::string path, Core::RenderContext& context)
+void createFlockWhenReady()
 {
-	Assimp::Importer import;
-	const aiScene* scene = import.ReadFile(path,
-		aiProcess_Triangulate |
-		aiProcess_CalcTangentSpace |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_GenSmoothNormals |
-		aiProcess_ImproveCacheLocality |
-		aiProcess_RemoveRedundantMaterials |
-		aiProcess_OptimizeMeshes);
-
-	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
-	{
-		std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+	// the flock starts with the placeholder gradients; the streamed array replaces them later
+	if (flockReady || birdContext.size == 0)
 		return;
+	{
+		STARTUP_PHASE("Flock");
+		flock = Flock(&simulationParams, terrain, birdContext, gradientTextureArray, 10);
+	}
+	shaderLoader.PrepareProgram(impostorBakeShader);
+	{
+		STARTUP_PHASE("Impostor bake");
+		flock.bakeImpostors(impostorBakeShader);
 	}
-	context.initFromAssimpMesh(scene->mMeshes[0]);
+	flockReady = true;
+}
+
+void loadModelAsync(const char* name, std::string path, Core::RenderContext& context, bool isBird = false)
+{
+	assetLoader.load(name, [path, &context, isBird]() -> AssetLoader::UploadStep {
+		std::shared_ptr<Core::MeshData> mesh = std::make_shared<Core::MeshData>();
+		if (!Core::LoadMeshData(path, *mesh))
+			return AssetLoader::UploadStep();
+		return [mesh, &context, isBird]() {
+			Core::UploadMeshData(*mesh, context);
+			if (isBird)
+				createFlockWhenReady();
+		};
+	});
+}
+
+// Starts loading all textures and models on the worker threads; they show up over the next frames.
+void loadAssetsAsync()
+{
+	loadModelAsync("Load bird", "./models/bird.objj", birdContext, true);
+	loadModelAsync("Load tree", "./models/tree.objj", treeContext);
+	loadModelAsync("Load sky cube", "./models/cube.objj", skyboxCube);
+
+	assetLoader.load("Load gradients", []() -> AssetLoader::UploadStep {
+		std::shared_ptr<std::vector<Core::ImageData>> layers = std::make_shared<std::vector<Core::ImageData>>(10);
+		for (int i = 0; i < 10; ++i)
+			Core::LoadImageData(("textures/gradient_" + std::to_string(i + 1) + ".png").c_str(), (*layers)[i]);
+		return [layers]() {
+			textureStreamer.stream(GL_TEXTURE_2D_ARRAY, layers, [](GLuint texture) {
+				gradientTextureArray = texture;
+				flock.textureArray = texture;
+			});
+		};
+	});
+
+	assetLoader.load("Load terrain texture", []() -> AssetLoader::UploadStep {
+		std::shared_ptr<std::vector<Core::ImageData>> image = std::make_shared<std::vector<Core::ImageData>>(1);
+		Core::LoadImageData("textures/terrain/rocky.jpg", image->front());
+		return [image]() {
+			textureStreamer.stream(GL_TEXTURE_2D, image, [](GLuint texture) { terrainTexture = texture; });
+		};
+	});
+	assetLoader.load("Load terrain normal map", []() -> AssetLoader::UploadStep {
+		std::shared_ptr<std::vector<Core::ImageData>> image = std::make_shared<std::vector<Core::ImageData>>(1);
+		Core::LoadImageData("textures/terrain/normal.jpg", image->front(), true);
+		return [image]() {
+			textureStreamer.stream(GL_TEXTURE_2D, image, [](GLuint texture) { terrainNormal = texture; });
+		};
+	});
+
+	assetLoader.load("Load sky box", []() -> AssetLoader::UploadStep {
+		std::shared_ptr<std::vector<Core::ImageData>> faces = std::make_shared<std::vector<Core::ImageData>>(skyboxFaces.size());
+		for (size_t i = 0; i < skyboxFaces.size(); ++i)
+			Core::LoadImageData(skyboxFaces[i].c_str(), (*faces)[i]);
+		return [faces]() {
+			textureStreamer.stream(GL_TEXTURE_CUBE_MAP, faces, [](GLuint texture) { skyboxTexture = texture; });
+		};
+	});
 }
 
 void init(GLFWwindow* window)
 {
+	CPU_ZONE("init");
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
 	glEnable(GL_DEPTH_TEST);
@@ -362,27 +453,41 @@ void init(GLFWwindow* window)
 	programEarth = shaderLoader.CreateProgram("shaders/shader_5_1_tex.vert", "shaders/shader_5_1_tex.frag");
 	programProcTex = shaderLoader.CreateProgram("shaders/shader_5_1_tex.vert", "shaders/shader_5_1_tex.frag");
 
-	loadModelToContext("./models/bird.objj", birdContext);
-	loadModelToContext("./models/tree.objj", treeContext);
-
-	initShadowMap();
+	{
+		STARTUP_PHASE("Texture placeholders");
+		textureStreamer.init();
+	}
+	terrainTexture = textureStreamer.placeholder(GL_TEXTURE_2D, 128, 128, 128);
+	terrainNormal = textureStreamer.placeholder(GL_TEXTURE_2D, 128, 128, 255);
+	gradientTextureArray = textureStreamer.placeholder(GL_TEXTURE_2D_ARRAY, 255, 255, 255);
+	skyboxTexture = textureStreamer.placeholder(GL_TEXTURE_CUBE_MAP, 150, 180, 220);
 
-	glfwSetCursorPosCallback(window, mouse_callback);
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	// room for the bird, tree and cube, so the pool does not grow (and copy) while they load
+	Core::GetMeshPool().reserve(64 * 1024, 256 * 1024);
+	assetLoader.start();
+	loadAssetsAsync();
 
-	for (int i = 0; i < 10; ++i) {
-		std::string texturePath = "textures/gradient_" + std::to_string(i+1) + ".png";
-		gradientTextures[i] = Core::LoadTexture(texturePath.c_str());
+	{
+		STARTUP_PHASE("Shadow map");
+		shadowMap.init();
 	}
+	renderQueue.profiler = &gpuProfiler;
+	renderQueue.prepareProgram = [](GLuint program) { shaderLoader.PrepareProgram(program); };
 
-	terrainTexture = Core::LoadTexture("textures/terrain/rocky.jpg");
-	terrainNormal = Core::LoadTexture("textures/terrain/normal.jpg");
+	glfwSetCursorPosCallback(window, mouse_callback);
+	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	setupBoidVAOandVBO(boidVAO, boidVBO, boidVertices, sizeof(boidVertices));
 	setupBoundingBox(boundingBoxVAO, boundingBoxVBO, boundingBoxEBO);
 
-	terrain = new ProceduralTerrain(150.0f, 100);
-	terrain->translateTerrain(glm::vec3(0.0f, -22.0f, 0.0f));
+	{
+		STARTUP_PHASE("Terrain");
+		TerrainParams terrainParams = ProceduralTerrain::makeParams(150.0f, 100);
+		if (!parseTerrainNoiseMode(runOptions.terrainNoise, terrainParams.mode))
+			std::cout << "Unknown terrain noise: " << runOptions.terrainNoise << ", using perlin" << std::endl;
+		terrain = new ProceduralTerrain(terrainParams, assetLoader.jobSystem(), "terrain_cache/", runOptions.regenerateTerrain);
+		terrain->translateTerrain(glm::vec3(0.0f, -22.0f, 0.0f));
+	}
 
 	boidShader = shaderLoader.CreateProgram("shaders/boid.vert", "shaders/boid.frag");
 	basicBoidShader = shaderLoader.CreateProgram("shaders/boid_basic.vert", "shaders/boid_basic.frag");
@@ -392,32 +497,34 @@ void init(GLFWwindow* window)
 	terrainShader = shaderLoader.CreateProgram("shaders/terrain.vert", "shaders/terrain.frag");
 	basicTerrainShader = shaderLoader.CreateProgram("shaders/terrain_basic.vert", "shaders/terrain_basic.frag");
 
-	depthShader = shaderLoader.CreateProgram("shaders/depth_shader.vert", "shaders/depth_shader.frag");
+	depthShader = shaderLoader.CreateProgram("shaders/depth_shader.vert", "shaders/depth_shader.geom", "shaders/depth_shader.frag");
+	boidDepthShader = shaderLoader.CreateProgram("shaders/boid_depth.vert", "shaders/depth_shader.geom", "shaders/depth_shader.frag");
 
 	activeBoidShader = boidShader;
 	activeTerrainShader = terrainShader;
 
-	modelLoc = glGetUniformLocation(boidShader, "model");
-	viewLoc = glGetUniformLocation(boidShader, "view");
-	projectionLoc = glGetUniformLocation(boidShader, "projection");
-
-	terrainProjectionLoc = glGetUniformLocation(terrainShader, "projection");
-	terrainViewLoc = glGetUniformLocation(terrainShader, "view");
-	terrainModelLoc = glGetUniformLocation(terrainShader, "model");
-	terrainColorLoc = glGetUniformLocation(terrainShader, "objectColor");
   
-	initWidget(window);
+	{
+		STARTUP_PHASE("ImGui");
+		initWidget(window);
+	}
 
-	flock = Flock(&simulationParams, terrain, birdContext, gradientTextures);
+	impostorShader = shaderLoader.CreateProgram("shaders/impostor.vert", "shaders/impostor.frag");
+	impostorBakeShader = shaderLoader.CreateProgram("shaders/impostor_bake.vert", "shaders/impostor_bake.frag");
 
 	skyboxShader = shaderLoader.CreateProgram("shaders/skybox.vert", "shaders/skybox.frag");
-	skyboxTexture = loadCubemap(skyboxFaces);
-	loadModelToContext("./models/cube.objj", skyboxCube);
 }
 
 void shutdown(GLFWwindow* window)
 {
+	assetLoader.stop();
+	textureStreamer.destroy();
+	Core::GetMeshPool().destroy();
 	shaderLoader.DeleteProgram(program);
+	shadowMap.destroy();
+	frameGraph.destroy();
+	flock.impostorAtlas.destroy();
+	gpuProfiler.destroy();
 	if (terrain) {
 		delete terrain;
 		terrain = nullptr;
@@ -426,6 +533,7 @@ void shutdown(GLFWwindow* window)
 
 void processInput(GLFWwindow* window)
 {
+	CPU_ZONE("processInput");
 	glm::vec3 cameraSide = glm::normalize(glm::cross(cameraDir, glm::vec3(0.f, 1.f, 0.f)));
 	glm::vec3 cameraUp = glm::vec3(0.f, 1.f, 0.f);
 	float angleSpeed = 0.075f;
@@ -452,11 +560,6 @@ void processInput(GLFWwindow* window)
 		if (!key1WasPressed) {
 			activeTerrainShader = (activeTerrainShader == terrainShader) ? basicTerrainShader : terrainShader;
 
-			terrainProjectionLoc = glGetUniformLocation(activeTerrainShader, "projection");
-			terrainViewLoc = glGetUniformLocation(activeTerrainShader, "view");
-			terrainModelLoc = glGetUniformLocation(activeTerrainShader, "model");
-			terrainColorLoc = glGetUniformLocation(activeTerrainShader, "objectColor");
-
 			key1WasPressed = true;
 		}
 	}
@@ -468,10 +571,6 @@ void processInput(GLFWwindow* window)
 		if (!key2WasPressed) {
 			activeBoidShader = (activeBoidShader == boidShader) ? basicBoidShader : boidShader;
 
-			modelLoc = glGetUniformLocation(activeBoidShader, "model");
-			viewLoc = glGetUniformLocation(activeBoidShader, "view");
-			projectionLoc = glGetUniformLocation(activeBoidShader, "projection");
-
 			key2WasPressed = true;
 		}
 	}
@@ -489,6 +588,24 @@ void processInput(GLFWwindow* window)
 		key3WasPressed = false;
 	}
 
+	// F9 starts a CPU trace capture, pressing it again writes the trace
+	if (glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS) {
+		if (!f9WasPressed) {
+			CpuProfiler& profiler = CpuProfiler::instance();
+			if (profiler.isCapturing()) {
+				if (profiler.stopCapture())
+					std::cout << "CPU trace written to " << runOptions.tracePath << std::endl;
+			}
+			else {
+				profiler.startCapture(runOptions.tracePath);
+			}
+			f9WasPressed = true;
+		}
+	}
+	else {
+		f9WasPressed = false;
+	}
+
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
 		if (!escapeWasPressed) {
 			cursorEnabled = !cursorEnabled;
@@ -506,13 +623,217 @@ void processInput(GLFWwindow* window)
 	}
 }
 
+// Prints the startup phases and writes them to the report file; startup recording ends here.
+void finishStartupReport() {
+	StartupReport& report = StartupReport::instance();
+	report.finish();
+	report.print(std::cout);
+	if (!report.writeJson(runOptions.startupReportPath))
+		std::cout << "cannot write startup report " << runOptions.startupReportPath << std::endl;
+}
+
 void renderLoop(GLFWwindow* window) {
+	bool firstFrame = true;
+	bool assetsReported = false;
 	while (!glfwWindowShouldClose(window))
 	{
+		CpuProfiler::instance().update();
+		CPU_ZONE("Frame");
+		bool loaded = assetLoader.pump(assetUploadBudgetMs);
+		textureStreamer.update();
+		if (terrain)
+			terrain->update(cameraPos);
+		bool terrainReady = !terrain || terrain->ready();
+		if (!assetsReported && loaded && textureStreamer.idle() && terrainReady) {
+			StartupReport::instance().mark("all assets loaded");
+			assetsReported = true;
+			if (!firstFrame)
+				finishStartupReport();
+		}
 		processInput(window);
 		renderScene(window);
-		flock.update(simulationParams.deltaTime);
+		if (firstFrame) {
+			StartupReport::instance().mark("first frame");
+			firstFrame = false;
+			if (assetsReported)
+				finishStartupReport();
+		}
+		if (flockReady)
+			flock.update(simulationParams.deltaTime);
+		glfwPollEvents();
+	}
+	destroyWidget();
+
+	if (CpuProfiler::instance().isCapturing())
+		CpuProfiler::instance().stopCapture();
+}
+
+float percentile(std::vector<float> values, float p) {
+	if (values.empty())
+		return 0.0f;
+	size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+// Renders frameCount frames along a fixed orbit around the flock into an offscreen FBO and
+// prints the frame time distribution. The render section ends with glFinish so the times
+// include the GPU work; the flock simulation runs after it and is reported on its own.
+// Returns the process exit code.
+int runRenderBenchmark(GLFWwindow* window, int frameCount) {
+	const int warmupFrames = 10;
+
+	int width, height;
+	glfwGetFramebufferSize(window, &width, &height);
+
+	GLuint colorBuffer, depthBuffer;
+	glGenFramebuffers(1, &sceneFramebuffer);
+	glGenRenderbuffers(1, &colorBuffer);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "Benchmark framebuffer is incomplete" << std::endl;
+		return 1;
+	}
+	glfwSwapInterval(0);
+	// the benchmark measures a fully loaded scene
+	assetLoader.finish();
+	textureStreamer.finish();
+	if (terrain)
+		terrain->finish(cameraPos);
+
+	std::vector<float> frameTimes;
+	frameTimes.reserve(frameCount);
+	double simulationTotal = 0.0;
+	double drawCalls = 0.0, programChanges = 0.0, textureChanges = 0.0;
+
+	for (int frame = 0; frame < warmupFrames + frameCount; ++frame) {
+		float t = frame / static_cast<float>(warmupFrames + frameCount) * glm::two_pi<float>();
+		cameraPos = glm::vec3(glm::cos(t) * 30.0f, 5.0f + glm::sin(2.0f * t) * 3.0f, glm::sin(t) * 30.0f);
+		cameraDir = glm::normalize(glm::vec3(0.0f) - cameraPos);
+
+		double start = glfwGetTime();
+		renderScene(window);
+		glFinish();
+		double end = glfwGetTime();
+		if (flockReady)
+			flock.update(simulationParams.deltaTime);
+		double simulationEnd = glfwGetTime();
 		glfwPollEvents();
+
+		if (frame < warmupFrames)
+			continue;
+		frameTimes.push_back(static_cast<float>((end - start) * 1000.0));
+		simulationTotal += (simulationEnd - end) * 1000.0;
+		// stats holds this frame's counters until the next renderScene calls beginFrame
+		drawCalls += renderQueue.stats.drawCalls;
+		programChanges += renderQueue.stats.programChanges;
+		textureChanges += renderQueue.stats.textureChanges;
 	}
+
+	float total = 0.0f;
+	for (float time : frameTimes)
+		total += time;
+
+	std::cout << "renderer: " << glGetString(GL_RENDERER) << std::endl;
+	std::cout << "frames: " << frameCount << " (" << width << "x" << height << ")" << std::endl;
+	std::cout << "frame_ms_mean: " << total / frameCount << std::endl;
+	std::cout << "frame_ms_p50: " << percentile(frameTimes, 0.5f) << std::endl;
+	std::cout << "frame_ms_p90: " << percentile(frameTimes, 0.9f) << std::endl;
+	std::cout << "frame_ms_p99: " << percentile(frameTimes, 0.99f) << std::endl;
+	std::cout << "frame_ms_max: " << percentile(frameTimes, 1.0f) << std::endl;
+	std::cout << "simulation_ms_mean: " << simulationTotal / frameCount << std::endl;
+	std::cout << "draw_calls_per_frame: " << drawCalls / frameCount << std::endl;
+	std::cout << "program_changes_per_frame: " << programChanges / frameCount << std::endl;
+	std::cout << "texture_changes_per_frame: " << textureChanges / frameCount << std::endl;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &sceneFramebuffer);
+	glDeleteRenderbuffers(1, &colorBuffer);
+	glDeleteRenderbuffers(1, &depthBuffer);
+	sceneFramebuffer = 0;
+	destroyWidget();
+	return 0;
+}
+
+// Loads every asset, draws one frame (which links the shaders it uses) and writes the startup
+// report. Used for the runs of --bench-startup.
+int runStartupOnly(GLFWwindow* window) {
+	assetLoader.finish();
+	textureStreamer.finish();
+	if (terrain)
+		terrain->finish(cameraPos);
+	StartupReport::instance().mark("all assets loaded");
+	renderScene(window);
+	glFinish();
+	StartupReport::instance().mark("first frame");
+	finishStartupReport();
 	destroyWidget();
+	return 0;
+}
+
+// Deletes the caches the program writes next to its assets (imported meshes, compressed
+// textures, program binaries) and the terrain tile cache, so the next start has to build all of them again.
+void removeAssetCaches() {
+	const char* directories[] = { "terrain_cache/", "models/", "shaders/", "textures/", "textures/terrain/",
+		"textures/skybox/mountain/", "textures/skybox/clouds/" };
+	const char* suffixes[] = { ".terraincache", ".meshcache", ".png.dds", ".jpg.dds", ".bmp.dds", ".progbin" };
+	for (const char* directory : directories) {
+		for (const std::string& name : Core::ListFiles(directory)) {
+			for (const char* suffix : suffixes) {
+				size_t length = std::strlen(suffix);
+				if (name.size() > length && name.compare(name.size() - length, length, suffix) == 0)
+					std::remove((directory + name).c_str());
+			}
+		}
+	}
+}
+
+// Starts the program runCount times with --startup-only and compares the runs. Before the
+// first run the asset caches are deleted, so it measures a cold start that decodes, imports,
+// compresses and links everything and writes the caches again; the later runs show the warm
+// startup. The OS file cache is not flushed, so the cold run still reads the source files
+// from memory if they were read recently. Each run leaves its report in startup_run<N>.json.
+// Returns the process exit code.
+int runStartupBenchmark(const std::string& executable, int runCount) {
+	removeAssetCaches();
+	std::vector<float> warmTotals;
+	float coldTotal = 0.0f;
+	for (int run = 1; run <= runCount; ++run) {
+		std::string reportPath = "startup_run" + std::to_string(run) + ".json";
+		std::string command = "\"" + executable + "\" --startup-only --startup-report " + reportPath;
+		// --regen-terrain is not passed on: removeAssetCaches already makes run 1 compute the
+		// tiles, and the warm runs have to read them back
+		if (runOptions.useEgl)
+			command += " --egl";
+#ifdef _WIN32
+		// cmd.exe drops the first and last quote of the whole command line
+		command = "\"" + command + "\"";
+#endif
+		if (std::system(command.c_str()) != 0) {
+			std::cout << "startup run " << run << " failed" << std::endl;
+			return 1;
+		}
+
+		float total = static_cast<float>(StartupReport::readMilestone(reportPath, "total"));
+		float init = static_cast<float>(StartupReport::readMilestone(reportPath, "init"));
+		std::cout << "run " << run << (run == 1 ? " (cold)" : " (warm)") << ": init " << init << " ms, total " << total << " ms" << std::endl;
+		if (run == 1)
+			coldTotal = total;
+		else
+			warmTotals.push_back(total);
+	}
+
+	std::cout << "startup_ms_cold: " << coldTotal << std::endl;
+	if (!warmTotals.empty()) {
+		std::cout << "startup_ms_warm_p50: " << percentile(warmTotals, 0.5f) << std::endl;
+		std::cout << "startup_ms_warm_min: " << percentile(warmTotals, 0.0f) << std::endl;
+	}
+	return 0;
 }
@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "JobSystem.h"
+#include "../profiling/StartupReport.h"
+
+// Loads assets in two steps. The CPU step (reading files, decoding images, importing meshes)
+// runs as a job on the worker pool and returns the GL step, which is queued for the GL thread.
+// pump() drains that queue within a per-frame time budget, so the window keeps rendering while
+// assets fill in. Names passed to load() must be string literals (they label profiler zones and
+// startup phases: the CPU step is reported on the worker thread, the GL step on the main thread).
+class AssetLoader {
+public:
+	using UploadStep = std::function<void()>;
+
+	void start(int workerCount = 0) {
+		jobs.start(workerCount);
+	}
+
+	// load runs on a worker thread; the step it returns runs on the GL thread (may be empty)
+	void load(const char* name, std::function<UploadStep()> load) {
+		pending++;
+		jobs.submit([this, name, load]() {
+			UploadStep upload;
+			{
+				StartupPhase phase(name);
+				upload = load();
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				uploads.push_back({ name, std::move(upload) });
+			}
+			uploadReady.notify_one();
+		});
+	}
+
+	// Runs queued GL steps until budgetMs is spent; at least one runs if any is waiting.
+	// Returns true once everything submitted so far is loaded.
+	bool pump(double budgetMs) {
+		int64_t deadlineUs = CpuProfiler::nowUs() + static_cast<int64_t>(budgetMs * 1000.0);
+		do {
+			Upload upload;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (uploads.empty())
+					break;
+				upload = std::move(uploads.front());
+				uploads.pop_front();
+			}
+			run(upload);
+		} while (CpuProfiler::nowUs() < deadlineUs);
+		return done();
+	}
+
+	// Blocks the GL thread until everything is loaded, uploading as results arrive.
+	void finish() {
+		while (!done()) {
+			Upload upload;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				uploadReady.wait(lock, [this]() { return !uploads.empty(); });
+				upload = std::move(uploads.front());
+				uploads.pop_front();
+			}
+			run(upload);
+		}
+	}
+
+	// the worker pool, for other background work that should not start threads of its own
+	JobSystem& jobSystem() {
+		return jobs;
+	}
+
+	bool done() const {
+		return pending.load() == 0;
+	}
+
+	int remaining() const {
+		return pending.load();
+	}
+
+	// Waits for the running jobs; GL steps still queued are dropped.
+	void stop() {
+		jobs.stop();
+		std::lock_guard<std::mutex> lock(mutex);
+		uploads.clear();
+	}
+
+private:
+	struct Upload {
+		const char* name = nullptr;
+		UploadStep step;
+	};
+
+	JobSystem jobs;
+	std::mutex mutex;
+	std::condition_variable uploadReady;
+	std::deque<Upload> uploads;
+	std::atomic<int> pending{ 0 };
+
+	void run(Upload& upload) {
+		{
+			StartupPhase phase(upload.name);
+			if (upload.step)
+				upload.step();
+		}
+		pending--;
+	}
+};
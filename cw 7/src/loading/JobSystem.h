@@ -0,0 +1,79 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../profiling/CpuProfiler.h"
+
+// Fixed pool of worker threads running jobs in submission order. Jobs must not touch GL;
+// anything that needs the context is handed back to the GL thread, as AssetLoader::pump does
+// with the upload steps and TextureStreamer with the texture levels.
+class JobSystem {
+public:
+	~JobSystem() {
+		stop();
+	}
+
+	// workerCount 0 leaves one hardware thread for the GL thread
+	void start(int workerCount = 0) {
+		if (!workers.empty())
+			return;
+		if (workerCount <= 0)
+			workerCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+		stopping = false;
+		for (int i = 0; i < workerCount; ++i)
+			workers.emplace_back([this, i]() { workerMain(i); });
+	}
+
+	void submit(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		wakeWorker.notify_one();
+	}
+
+	// Runs the remaining jobs to completion and joins the workers.
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeWorker.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+		workers.clear();
+	}
+
+	int workerCount() const {
+		return static_cast<int>(workers.size());
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wakeWorker;
+	bool stopping = false;
+
+	void workerMain(int index) {
+		CpuProfiler::instance().setThreadName("Worker " + std::to_string(index));
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeWorker.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+};
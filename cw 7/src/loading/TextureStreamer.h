@@ -0,0 +1,197 @@
+#pragma once
+#include "glew.h"
+
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "../Texture.h"
+#include "../profiling/StartupReport.h"
+
+// Streams texture data to the GPU through a ring of pixel unpack buffers. Each frame update()
+// copies mip levels into the next free buffer until the byte budget is spent and issues the
+// glTex(Sub)Image call from the buffer, so the driver does the transfer without stalling the
+// GL thread. Levels larger than a slot go through the ring as bands of rows, and uncompressed
+// images arrive with their mip chain already built by the decode job, so nothing here waits on
+// a synchronous upload or a glGenerateMipmap. A fence per ring slot tells when the buffer may
+// be overwritten, and a fence after the last level tells when the texture is complete; only
+// then is it handed out through onResident. Until that moment the caller binds a 1x1
+// placeholder.
+class TextureStreamer {
+public:
+	using ResidentCallback = std::function<void(GLuint)>;
+
+	static const int RING_SLOTS = 3;
+	static const size_t SLOT_BYTES = 4 * 1024 * 1024;
+
+	// bytes copied per frame; a band bigger than the budget still goes alone
+	size_t budgetBytes = 2 * 1024 * 1024;
+
+	void init() {
+		glGenBuffers(RING_SLOTS, buffers);
+		for (int i = 0; i < RING_SLOTS; i++) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, SLOT_BYTES, NULL, GL_STREAM_DRAW);
+			fences[i] = 0;
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	// Single texel texture of the given target (GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY or
+	// GL_TEXTURE_CUBE_MAP). Placeholders are shared and live until destroy().
+	GLuint placeholder(GLenum target, unsigned char r, unsigned char g, unsigned char b) {
+		unsigned key = (unsigned)r << 16 | (unsigned)g << 8 | b;
+		GLuint& id = placeholders[{ target, key }];
+		if (id != 0)
+			return id;
+		unsigned char texel[4] = { r, g, b, 255 };
+		glGenTextures(1, &id);
+		glBindTexture(target, id);
+		if (target == GL_TEXTURE_2D_ARRAY)
+			glTexImage3D(target, 0, GL_RGBA, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+		else if (target == GL_TEXTURE_CUBE_MAP)
+			for (int face = 0; face < 6; face++)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+		else
+			glTexImage2D(target, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		return id;
+	}
+
+	// Allocates the texture and queues its levels. The images are kept alive until the upload
+	// is done; onResident runs on the GL thread once the GPU has all of the data.
+	void stream(GLenum bindTarget, std::shared_ptr<std::vector<Core::ImageData>> images, ResidentCallback onResident) {
+		Job job;
+		job.images = images;
+		Core::TextureUploadPlan plan = Core::PlanTextureUpload(bindTarget, images->data(), (int)images->size());
+		job.plan.texture = plan.texture;
+		job.plan.bindTarget = plan.bindTarget;
+		for (const Core::TextureLevelUpload& upload : plan.levels) {
+			if (upload.size <= SLOT_BYTES) {
+				job.plan.levels.push_back(upload);
+				continue;
+			}
+			std::vector<Core::TextureLevelUpload> bands = Core::SplitTextureLevel(upload, SLOT_BYTES);
+			job.plan.levels.insert(job.plan.levels.end(), bands.begin(), bands.end());
+		}
+		job.onResident = std::move(onResident);
+		queued.push_back(std::move(job));
+	}
+
+	// Call once per frame on the GL thread.
+	void update() {
+		STARTUP_PHASE("Texture streaming");
+		retireFinished();
+
+		size_t copied = 0;
+		while (!queued.empty()) {
+			Job& job = queued.front();
+			if (job.next < job.plan.levels.size()) {
+				const Core::TextureLevelUpload& upload = job.plan.levels[job.next];
+				if (copied > 0 && copied + upload.size > budgetBytes)
+					break;
+				if (!submit(job.plan, upload))
+					break;
+				copied += upload.size;
+				job.next++;
+				continue;
+			}
+			job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			uploading.push_back(std::move(job));
+			queued.pop_front();
+		}
+	}
+
+	// Pushes everything out regardless of the budget and waits for the GPU.
+	void finish() {
+		size_t budget = budgetBytes;
+		budgetBytes = (size_t)-1;
+		while (!idle()) {
+			update();
+			glFinish();
+		}
+		budgetBytes = budget;
+	}
+
+	bool idle() const {
+		return queued.empty() && uploading.empty();
+	}
+
+	void destroy() {
+		for (Job& job : uploading)
+			glDeleteSync(job.fence);
+		uploading.clear();
+		queued.clear();
+		for (int i = 0; i < RING_SLOTS; i++) {
+			if (fences[i])
+				glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+		if (buffers[0])
+			glDeleteBuffers(RING_SLOTS, buffers);
+		buffers[0] = 0;
+		for (auto& placeholder : placeholders)
+			glDeleteTextures(1, &placeholder.second);
+		placeholders.clear();
+	}
+
+private:
+	struct Job {
+		std::shared_ptr<std::vector<Core::ImageData>> images;
+		Core::TextureUploadPlan plan;
+		size_t next = 0;
+		GLsync fence = 0;
+		ResidentCallback onResident;
+	};
+
+	GLuint buffers[RING_SLOTS] = {};
+	GLsync fences[RING_SLOTS] = {};
+	int nextSlot = 0;
+	std::deque<Job> queued;
+	std::deque<Job> uploading;
+	std::map<std::pair<GLenum, unsigned>, GLuint> placeholders;
+
+	static bool signaled(GLsync fence) {
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+	}
+
+	// Returns false when the next ring slot is still being read by the GPU.
+	bool submit(const Core::TextureUploadPlan& plan, const Core::TextureLevelUpload& upload) {
+		glBindTexture(plan.bindTarget, plan.texture);
+		GLsync& fence = fences[nextSlot];
+		if (fence) {
+			if (!signaled(fence))
+				return false;
+			glDeleteSync(fence);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[nextSlot]);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, upload.size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (mapped) {
+			memcpy(mapped, upload.data, upload.size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			Core::UploadTextureLevel(upload, (const void*)0);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (!mapped)
+			Core::UploadTextureLevel(upload, upload.data);
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		nextSlot = (nextSlot + 1) % RING_SLOTS;
+		return true;
+	}
+
+	void retireFinished() {
+		while (!uploading.empty() && signaled(uploading.front().fence)) {
+			Job& job = uploading.front();
+			glDeleteSync(job.fence);
+			if (job.onResident)
+				job.onResident(job.plan.texture);
+			uploading.pop_front();
+		}
+	}
+};
@@ -11,8 +11,20 @@
 
 int main(int argc, char** argv)
 {
+	StartupReport::instance().start();
+	runOptions = parseRunOptions(argc, argv);
+	// benchmark startu uruchamia program kilka razy jako osobne procesy, sam nie tworzy okna
+	if (runOptions.benchStartupRuns > 0)
+		return runStartupBenchmark(argv[0], runOptions.benchStartupRuns);
+	CpuProfiler::instance().setThreadName("Main");
+	if (runOptions.traceSeconds > 0.0)
+		CpuProfiler::instance().startCapture(runOptions.tracePath, runOptions.traceSeconds);
+
 	// inicjalizacja glfw
-	glfwInit();
+	{
+		STARTUP_PHASE("GLFW init");
+		glfwInit();
+	}
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -21,26 +33,53 @@ int main(int argc, char** argv)
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
+	// benchmark renderuje do FBO, okno jest tylko nosnikiem kontekstu
+	bool benchmark = runOptions.benchRenderFrames > 0;
+	if (benchmark || runOptions.startupOnly)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	if (runOptions.useEgl)
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+
 	// tworzenie okna za pomoca glfw
-	GLFWwindow* window = glfwCreateWindow(1200, 800, "Boid Simulation", NULL, NULL);
-	if (window == NULL)
+	GLFWwindow* window;
 	{
-		std::cout << "Failed to create GLFW window" << std::endl;
-		glfwTerminate();
-		return -1;
+		STARTUP_PHASE("Window and context");
+		window = glfwCreateWindow(1200, 800, "Boid Simulation", NULL, NULL);
+		if (window == NULL)
+		{
+			std::cout << "Failed to create GLFW window" << std::endl;
+			glfwTerminate();
+			return -1;
+		}
+		glfwMakeContextCurrent(window);
 	}
-	glfwMakeContextCurrent(window);
 
 	// ladowanie OpenGL za pomoca glew
-	glewInit();
+	{
+		STARTUP_PHASE("GLEW init");
+		glewInit();
+	}
 	glViewport(0, 0, 1200, 800);
 
-	init(window);
+	{
+		STARTUP_PHASE("init");
+		init(window);
+	}
+	StartupReport::instance().mark("init");
 
-	// uruchomienie glownej petli
-	renderLoop(window);
+	int exitCode = 0;
+	if (runOptions.startupOnly) {
+		exitCode = runStartupOnly(window);
+	}
+	else if (benchmark) {
+		exitCode = runRenderBenchmark(window, runOptions.benchRenderFrames);
+	}
+	else {
+		// uruchomienie glownej petli
+		renderLoop(window);
+	}
 
 	shutdown(window);
 	glfwTerminate();
-	return 0;
+	return exitCode;
 }
@@ -25,14 +25,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #define OBJLOAD_H_
 
 #include <algorithm>
-#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 #include <string>
 #include <map>
 #include <set>
 #include <vector>
 
+#include "Mapped_File.h"
+
 namespace obj {
 
 struct Model {
@@ -62,11 +67,13 @@ struct ObjModel {
 };
 
 inline ObjModel parseObjModel( std::istream & in);
+inline ObjModel parseObjModel( const char * data, size_t size );
 inline void tesselateObjModel( ObjModel & obj);
 inline ObjModel tesselateObjModel( const ObjModel & obj );
 inline Model convertToModel( const ObjModel & obj );
 
 inline Model loadModel( std::istream & in );
+inline Model loadModelFromBuffer( const char * data, size_t size );
 inline Model loadModelFromString( const std::string & in );
 inline Model loadModelFromFile( const std::string & in );
 
@@ -83,86 +90,410 @@ inline bool ObjModel::FaceVertex::operator==( const ObjModel::FaceVertex & other
     return (v == other.v && t == other.t && n == other.n);
 }
 
-template <typename T>
-inline std::istream & operator>>(std::istream & in, std::vector<T> & vec ){
-    T temp;
-    if(in >> temp) 
-        vec.push_back(temp);
-    return in;
+namespace detail {
+
+// The parser works on the whole file in memory (usually mapped) and never copies a line.
+// Numbers are read the way the former iostream parser read them: up to three values per
+// v/vt/vn line, stopping at the first token that is not a number.
+
+inline bool isSpace( char c ){
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline void skipSpaces( const char * & p, const char * end ){
+    while(p < end && isSpace(*p))
+        ++p;
 }
 
-template <typename T>
-inline std::istream & operator>>(std::istream & in, std::set<T> & vec ){
-    T temp;
-    if(in >> temp) 
-        vec.insert(temp);
-    return in;
+inline bool parseInt( const char * & p, const char * end, int & value ){
+    const char * q = p;
+    bool negative = false;
+    if(q < end && (*q == '-' || *q == '+'))
+        negative = *q++ == '-';
+    if(q == end || *q < '0' || *q > '9')
+        return false;
+    int result = 0;
+    while(q < end && *q >= '0' && *q <= '9')
+        result = result * 10 + (*q++ - '0');
+    value = negative ? -result : result;
+    p = q;
+    return true;
 }
 
-inline std::istream & operator>>( std::istream & in, ObjModel::FaceVertex & f){
-    if(in >> f.v){
-        if(in.peek() == '/'){
-            in.get();
-            in >> f.t;
-            in.clear();
-            if(in.peek() == '/'){
-                in.get();
-                in >> f.n;
-                in.clear();
-            }
+// Exact for mantissas up to 2^24 and exponents up to 10 (both representable as float, so a single
+// correctly rounded multiply or divide gives the same value as strtof); everything else goes to strtof.
+inline bool parseFloat( const char * & p, const char * end, float & value ){
+    static const float powers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+    const char * start = p;
+    const char * q = p;
+    bool negative = false;
+    if(q < end && (*q == '-' || *q == '+'))
+        negative = *q++ == '-';
+
+    // up to 19 digits fit in the mantissa whatever they are
+    uint64_t mantissa = 0;
+    const char * digits = q;
+    while(q < end && static_cast<unsigned>(*q - '0') < 10)
+        mantissa = mantissa * 10 + (*q++ - '0');
+    int digitCount = static_cast<int>(q - digits);
+    int exponent = 0;
+    if(q < end && *q == '.'){
+        const char * fraction = ++q;
+        while(q < end && static_cast<unsigned>(*q - '0') < 10)
+            mantissa = mantissa * 10 + (*q++ - '0');
+        exponent = -static_cast<int>(q - fraction);
+        digitCount -= exponent;
+    }
+    if(digitCount == 0)
+        return false;
+    if(q < end && (*q == 'e' || *q == 'E')){
+        const char * e = q + 1;
+        int power;
+        if(parseInt(e, end, power)){
+            exponent += power;
+            q = e;
         }
-        in.clear();
-        --f.v;
-        --f.t;
-        --f.n;
     }
-    // std::cout << f << std::endl;
-    return in;
+    p = q;
+
+    if(digitCount <= 19 && mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10){
+        float result = static_cast<float>(mantissa);
+        result = exponent < 0 ? result / powers[-exponent] : result * powers[exponent];
+        value = negative ? -result : result;
+        return true;
+    }
+    std::string token(start, q);
+    value = std::strtof(token.c_str(), NULL);
+    return true;
 }
 
-ObjModel parseObjModel( std::istream & in ){
-    char line[1024];
-    std::string op;
-    std::istringstream line_in;
+inline void parseFloats( const char * & p, const char * end, std::vector<float> & out, int count ){
+    for(int i = 0; i < count; ++i){
+        skipSpaces(p, end);
+        float value;
+        if(!parseFloat(p, end, value))
+            return;
+        out.push_back(value);
+    }
+}
+
+// v, v/t, v//n or v/t/n; a missing t or n stays -2 and an empty one becomes -1, as before
+inline bool parseFaceVertex( const char * & p, const char * end, ObjModel::FaceVertex & f ){
+    skipSpaces(p, end);
+    if(!parseInt(p, end, f.v))
+        return false;
+    if(p < end && *p == '/'){
+        ++p;
+        if(!parseInt(p, end, f.t))
+            f.t = 0;
+        if(p < end && *p == '/'){
+            ++p;
+            if(!parseInt(p, end, f.n))
+                f.n = 0;
+        }
+    }
+    --f.v;
+    --f.t;
+    --f.n;
+    return true;
+}
+
+inline std::string parseToken( const char * & p, const char * end ){
+    skipSpaces(p, end);
+    const char * start = p;
+    while(p < end && !isSpace(*p) && *p != '\n')
+        ++p;
+    return std::string(start, p);
+}
+
+
+// Distinct face vertices, found through their position index: the entries sharing v are chained
+// from first[v], so a lookup is an array access and a short walk instead of hashing. Walking v in
+// ascending order also gives the sorted (v, t, n) order without sorting the whole list.
+class FaceVertexTable {
+public:
+    explicit FaceVertexTable( size_t positions = 0 ){
+        first.assign(positions, -1);
+        entries.reserve(positions);
+        next.reserve(positions);
+    }
+
+    // index of f in unique(), added if it is new
+    int insert( const ObjModel::FaceVertex & f ){
+        int * head = chain(f.v);
+        for(int i = *head; i >= 0; i = next[i])
+            if(entries[i].t == f.t && entries[i].n == f.n)
+                return i;
+        const int index = static_cast<int>(entries.size());
+        entries.push_back(f);
+        next.push_back(*head);
+        *head = index;
+        return index;
+    }
+
+    int lookup( const ObjModel::FaceVertex & f ) const {
+        int i = f.v >= 0 ? (static_cast<size_t>(f.v) < first.size() ? first[f.v] : -1) : negativeFirst(f.v);
+        while(i >= 0 && !(entries[i].t == f.t && entries[i].n == f.n))
+            i = next[i];
+        return i;
+    }
+
+    const std::vector<ObjModel::FaceVertex> & unique() const {
+        return entries;
+    }
+
+    // indices into unique() in ascending (v, t, n) order
+    std::vector<int> sortedOrder() const {
+        std::vector<int> order;
+        order.reserve(entries.size());
+        for(size_t c = 0; c < negative.size(); ++c)
+            for(int i = negative[c].second; i >= 0; i = next[i])
+                order.push_back(i);
+        sortTail(order, 0);
+        for(size_t v = 0; v < first.size(); ++v){
+            const size_t start = order.size();
+            for(int i = first[v]; i >= 0; i = next[i])
+                order.push_back(i);
+            // chains are short, usually a single entry
+            if(order.size() - start > 1)
+                sortTail(order, start);
+        }
+        return order;
+    }
+
+private:
+    std::vector<int> first;
+    std::vector<int> next;
+    std::vector<ObjModel::FaceVertex> entries;
+    // malformed negative position indices, kept apart from the array
+    std::vector<std::pair<int, int> > negative;
+
+    int * chain( int v ){
+        if(v >= 0){
+            if(static_cast<size_t>(v) >= first.size())
+                first.resize(std::max(static_cast<size_t>(v) + 1, first.size() * 2), -1);
+            return &first[v];
+        }
+        for(size_t c = 0; c < negative.size(); ++c)
+            if(negative[c].first == v)
+                return &negative[c].second;
+        negative.push_back(std::make_pair(v, -1));
+        return &negative.back().second;
+    }
+
+    int negativeFirst( int v ) const {
+        for(size_t c = 0; c < negative.size(); ++c)
+            if(negative[c].first == v)
+                return negative[c].second;
+        return -1;
+    }
+
+    void sortTail( std::vector<int> & order, size_t start ) const {
+        const std::vector<ObjModel::FaceVertex> & e = entries;
+        std::sort(order.begin() + start, order.end(), [&e](int a, int b){ return e[a] < e[b]; });
+    }
+};
+
+// Walks the file line by line; vertex attributes go straight into model, faces are handed to
+// sink.face together with the groups they belong to (sink.groupsChanged is called on every "g").
+template <typename FaceSink>
+inline void parseObjBuffer( const char * data, size_t size, ObjModel & model, FaceSink & sink ){
     std::set<std::string> groups;
     groups.insert("default");
-
-    ObjModel data;
-
-    while(in.good()){
-        in.getline(line, 1023);
-        line_in.clear();
-        line_in.str(line);
-
-        if(!(line_in >> op))
-            continue;
-        if(op == "v")
-            line_in >> data.vertex >> data.vertex >> data.vertex;
-        else if(op == "vt")
-            line_in >> data.texCoord >> data.texCoord >> data.texCoord;
-        else if(op == "vn")
-            line_in >> data.normal >> data.normal >> data.normal;
-        else if(op == "g"){
+    std::vector<ObjModel::FaceVertex> list;
+
+    const char * p = data;
+    const char * end = data + size;
+    while(p < end){
+        // the line is not searched for its end up front: '\n' is not a space, a digit or a token
+        // character, so every read below stops there by itself
+        const char * lineEnd = end;
+        skipSpaces(p, lineEnd);
+        const char * op = p;
+        while(p < lineEnd && !isSpace(*p) && *p != '\n')
+            ++p;
+        const size_t opLength = p - op;
+
+        if(opLength == 1 && op[0] == 'v')
+            parseFloats(p, lineEnd, model.vertex, 3);
+        else if(opLength == 2 && op[0] == 'v' && op[1] == 't')
+            parseFloats(p, lineEnd, model.texCoord, 3);
+        else if(opLength == 2 && op[0] == 'v' && op[1] == 'n')
+            parseFloats(p, lineEnd, model.normal, 3);
+        else if(opLength == 1 && op[0] == 'g'){
             groups.clear();
-            while(line_in >> groups) ;
+            for(std::string name = parseToken(p, lineEnd); !name.empty(); name = parseToken(p, lineEnd))
+                groups.insert(name);
             groups.insert("default");
+            sink.groupsChanged();
+        }
+        else if(opLength == 1 && op[0] == 'f'){
+            list.clear();
+            ObjModel::FaceVertex f;
+            while(parseFaceVertex(p, lineEnd, f)){
+                list.push_back(f);
+                f = ObjModel::FaceVertex();
+            }
+            sink.face(groups, list);
         }
-        else if(op == "f") {
-            std::vector<ObjModel::FaceVertex> list;
-            while(line_in >> list) ;
-            
+        const char * next = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        p = next ? next + 1 : end;
+    }
+}
+
+// Collects faces into ObjModel::faces, as parseObjModel always did.
+class FaceListSink {
+public:
+    explicit FaceListSink( ObjModel & model ) : model(model) {}
+
+    void groupsChanged(){
+        current.clear();
+    }
+
+    void face( const std::set<std::string> & groups, const std::vector<ObjModel::FaceVertex> & list ){
+        // a group gets an entry only once it has a face
+        if(current.empty())
+            for(std::set<std::string>::const_iterator g = groups.begin(); g != groups.end(); ++g)
+                current.push_back(&model.faces[*g]);
+        for(size_t g = 0; g < current.size(); ++g){
+            ObjModel::FaceList & fl = *current[g];
+            fl.second.push_back(fl.first.size());
+            fl.first.insert(fl.first.end(), list.begin(), list.end());
+        }
+    }
+
+private:
+    ObjModel & model;
+    std::vector<ObjModel::FaceList *> current;
+};
+
+// Appends the distinct face vertices to model in sorted (v, t, n) order, the order the original
+// sort based implementation produced, and returns the new index of every table entry.
+inline std::vector<unsigned short> emitVertices( const ObjModel & obj, const FaceVertexTable & table, Model & model ){
+    const std::vector<ObjModel::FaceVertex> & unique = table.unique();
+    const std::vector<int> order = table.sortedOrder();
+    std::vector<unsigned short> rank(unique.size());
+
+    // build a new model with repeated vertices/texcoords/normals to have single indexing
+    const bool texCoords = !obj.texCoord.empty(), normals = !obj.normal.empty();
+    model.vertex.resize(3 * order.size());
+    if(texCoords)
+        model.texCoord.resize(2 * order.size());
+    if(normals)
+        model.normal.resize(3 * order.size());
+    for(size_t i = 0; i < order.size(); ++i){
+        const ObjModel::FaceVertex & f = unique[order[i]];
+        rank[order[i]] = static_cast<unsigned short>(i);
+        std::copy(&obj.vertex[3*f.v], &obj.vertex[3*f.v] + 3, &model.vertex[3*i]);
+        if(texCoords){
+            const int index = (f.t > -1) ? f.t : f.v;
+            std::copy(&obj.texCoord[2*index], &obj.texCoord[2*index] + 2, &model.texCoord[2*i]);
+        }
+        if(normals){
+            const int index = (f.n > -1) ? f.n : f.v;
+            std::copy(&obj.normal[3*index], &obj.normal[3*index] + 3, &model.normal[3*i]);
+        }
+    }
+    return rank;
+}
+
+// Builds the Model while parsing: faces are fanned into triangles and deduplicated on the fly,
+// so the per group face vertex lists of ObjModel are never stored. Every triangle is stored once;
+// runs of faces record which groups they belong to and the group lists are filled at the end.
+class ModelSink {
+public:
+    void groupsChanged(){
+        changed = true;
+    }
+
+    void face( const std::set<std::string> & groups, const std::vector<ObjModel::FaceVertex> & list ){
+        if(changed){
+            // a group gets an entry only once it has a face
+            Run run;
+            run.start = triangles.size();
             for(std::set<std::string>::const_iterator g = groups.begin(); g != groups.end(); ++g){
-                ObjModel::FaceList & fl = data.faces[*g];
-                fl.second.push_back(fl.first.size());
-                fl.first.insert(fl.first.end(), list.begin(), list.end());
+                std::map<std::string, size_t>::iterator found = groupIndex.find(*g);
+                if(found == groupIndex.end()){
+                    found = groupIndex.insert(std::make_pair(*g, groupNames.size())).first;
+                    groupNames.push_back(*g);
+                }
+                run.groups.push_back(found->second);
             }
+            runs.push_back(run);
+            changed = false;
+        }
+        if(list.size() < 3){
+            for(size_t i = 0; i < list.size(); ++i)
+                triangles.push_back(table.insert(list[i]));
+            return;
+        }
+        const int first = table.insert(list[0]);
+        int previous = table.insert(list[1]);
+        for(size_t i = 2; i < list.size(); ++i){
+            const int current = table.insert(list[i]);
+            triangles.push_back(first);
+            triangles.push_back(previous);
+            triangles.push_back(current);
+            previous = current;
         }
     }
-    for(std::map<std::string, ObjModel::FaceList>::iterator g = data.faces.begin(); g != data.faces.end(); ++g){
+
+    Model finish( const ObjModel & attributes ){
+        Model model;
+        std::vector<unsigned short> rank = emitVertices(attributes, table, model);
+        std::vector<size_t> sizes(groupNames.size(), 0);
+        for(size_t r = 0; r < runs.size(); ++r)
+            for(size_t g = 0; g < runs[r].groups.size(); ++g)
+                sizes[runs[r].groups[g]] += runEnd(r) - runs[r].start;
+        std::vector<std::vector<unsigned short> *> out(groupNames.size());
+        for(size_t g = 0; g < groupNames.size(); ++g){
+            out[g] = &model.faces[groupNames[g]];
+            out[g]->reserve(sizes[g]);
+        }
+        for(size_t r = 0; r < runs.size(); ++r)
+            for(size_t g = 0; g < runs[r].groups.size(); ++g){
+                std::vector<unsigned short> & v = *out[runs[r].groups[g]];
+                for(size_t i = runs[r].start, end = runEnd(r); i < end; ++i)
+                    v.push_back(rank[triangles[i]]);
+            }
+        return model;
+    }
+
+private:
+    // faces from start up to the next run belong to the same groups
+    struct Run {
+        size_t start;
+        std::vector<size_t> groups;
+    };
+
+    FaceVertexTable table;
+    std::vector<int> triangles;
+    std::vector<Run> runs;
+    std::map<std::string, size_t> groupIndex;
+    std::vector<std::string> groupNames;
+    bool changed = true;
+
+    size_t runEnd( size_t r ) const {
+        return r + 1 < runs.size() ? runs[r + 1].start : triangles.size();
+    }
+};
+
+} // namespace detail
+
+ObjModel parseObjModel( const char * data, size_t size ){
+    ObjModel model;
+    detail::FaceListSink sink(model);
+    detail::parseObjBuffer(data, size, model, sink);
+    for(std::map<std::string, ObjModel::FaceList>::iterator g = model.faces.begin(); g != model.faces.end(); ++g){
         ObjModel::FaceList & fl = g->second;
         fl.second.push_back(fl.first.size());
     }
-    return data;
+    return model;
+}
+
+ObjModel parseObjModel( std::istream & in ){
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return parseObjModel(contents.data(), contents.size());
 }
 
 inline void tesselateObjModel( std::vector<ObjModel::FaceVertex> & input, std::vector<unsigned> & input_start){
@@ -199,34 +530,20 @@ void tesselateObjModel( ObjModel & obj){
 }
 
 Model convertToModel( const ObjModel & obj ) {
-    // insert all face vertices into a vector and make unique
-    std::vector<ObjModel::FaceVertex> unique(obj.faces.find("default")->second.first);
-    std::sort(unique.begin(), unique.end());
-    unique.erase( std::unique(unique.begin(), unique.end()), unique.end());
+    const std::vector<ObjModel::FaceVertex> & all = obj.faces.find("default")->second.first;
+    detail::FaceVertexTable table(obj.vertex.size() / 3);
+    for(std::vector<ObjModel::FaceVertex>::const_iterator f = all.begin(); f != all.end(); ++f)
+        table.insert(*f);
 
-    // build a new model with repeated vertices/texcoords/normals to have single indexing
     Model model;
-    for(std::vector<ObjModel::FaceVertex>::const_iterator f = unique.begin(); f != unique.end(); ++f){
-        model.vertex.insert(model.vertex.end(), obj.vertex.begin() + 3*f->v, obj.vertex.begin() + 3*f->v + 3);
-        if(!obj.texCoord.empty()){
-            const int index = (f->t > -1) ? f->t : f->v;
-            model.texCoord.insert(model.texCoord.end(), obj.texCoord.begin() + 2*index, obj.texCoord.begin() + 2*index + 2);
-        }
-        if(!obj.normal.empty()){
-            const int index = (f->n > -1) ? f->n : f->v;
-            model.normal.insert(model.normal.end(), obj.normal.begin() + 3*index, obj.normal.begin() + 3*index + 3);
-        }
-    }
+    std::vector<unsigned short> rank = detail::emitVertices(obj, table, model);
     // look up unique index and transform face descriptions
     for(std::map<std::string, ObjModel::FaceList>::const_iterator g = obj.faces.begin(); g != obj.faces.end(); ++g){
-        const std::string & name = g->first;
         const ObjModel::FaceList & fl = g->second;
         std::vector<unsigned short> & v = model.faces[g->first];
         v.reserve(fl.first.size());
-        for(std::vector<ObjModel::FaceVertex>::const_iterator f = fl.first.begin(); f != fl.first.end(); ++f){
-            const unsigned short index = std::distance(unique.begin(), std::lower_bound(unique.begin(), unique.end(), *f));
-            v.push_back(index);
-        }
+        for(std::vector<ObjModel::FaceVertex>::const_iterator f = fl.first.begin(); f != fl.first.end(); ++f)
+            v.push_back(rank[table.lookup(*f)]);
     }
     return model;
 }
@@ -237,20 +554,25 @@ ObjModel tesselateObjModel( const ObjModel & obj ){
     return result;
 }
 
+Model loadModelFromBuffer( const char * data, size_t size ){
+    ObjModel attributes;
+    detail::ModelSink sink;
+    detail::parseObjBuffer(data, size, attributes, sink);
+    return sink.finish(attributes);
+}
+
 Model loadModel( std::istream & in ){
-    ObjModel model = parseObjModel(in);
-    tesselateObjModel(model);
-    return convertToModel(model);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return loadModelFromBuffer(contents.data(), contents.size());
 }
 
 Model loadModelFromString( const std::string & str ){
-    std::istringstream in(str);
-    return loadModel(in);
+    return loadModelFromBuffer(str.data(), str.size());
 }
 
 Model loadModelFromFile( const std::string & str) {
-    std::ifstream in(str.c_str());
-    return loadModel(in);
+    Core::MappedFile file(str);
+    return loadModelFromBuffer(reinterpret_cast<const char *>(file.data()), file.size());
 }
 
 inline std::ostream & operator<<( std::ostream & out, const ObjModel::FaceVertex & f){
@@ -0,0 +1,71 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+struct RunOptions {
+    // record a CPU trace for the first traceSeconds of the run, 0 disables it
+    double traceSeconds = 0.0;
+    std::string tracePath = "trace.json";
+
+    // render this many frames offscreen along a fixed camera path and print timings, 0 runs normally
+    int benchRenderFrames = 0;
+    // create the context through EGL instead of GLX/WGL, for software renderers on headless machines
+    bool useEgl = false;
+    // ignore the terrain tile cache and generate the terrain from noise again
+    bool regenerateTerrain = false;
+    // terrain noise: perlin, fbm, ridged or warp
+    std::string terrainNoise = "perlin";
+
+    // where the startup phase report is written once all assets are loaded
+    std::string startupReportPath = "startup.json";
+    // start the program this many times with --startup-only and compare cold and warm startup, 0 runs normally
+    int benchStartupRuns = 0;
+    // load everything, draw one frame, write the startup report and exit
+    bool startupOnly = false;
+};
+
+RunOptions parseRunOptions(int argc, char** argv) {
+    RunOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--trace-seconds") == 0 && hasValue) {
+            options.traceSeconds = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(arg, "--trace-file") == 0 && hasValue) {
+            options.tracePath = argv[++i];
+        }
+        else if (std::strcmp(arg, "--bench-render") == 0 && hasValue) {
+            options.benchRenderFrames = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(arg, "--egl") == 0) {
+            options.useEgl = true;
+        }
+        else if (std::strcmp(arg, "--regen-terrain") == 0) {
+            options.regenerateTerrain = true;
+        }
+        else if (std::strcmp(arg, "--terrain-noise") == 0 && hasValue) {
+            options.terrainNoise = argv[++i];
+        }
+        else if (std::strcmp(arg, "--startup-report") == 0 && hasValue) {
+            options.startupReportPath = argv[++i];
+        }
+        else if (std::strcmp(arg, "--bench-startup") == 0 && hasValue) {
+            options.benchStartupRuns = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(arg, "--startup-only") == 0) {
+            options.startupOnly = true;
+        }
+        else {
+            std::cout << "Unknown option: " << arg << std::endl;
+        }
+    }
+    return options;
+}
+
+#endif //OPTIONS_H
@@ -0,0 +1,163 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct CpuZoneEvent {
+	const char* name;
+	int64_t startUs;
+	int64_t endUs;
+};
+
+// Scoped CPU zones recorded into one ring buffer per thread and written out as a Chrome
+// trace_event JSON (open in chrome://tracing or ui.perfetto.dev). Zone names must be string
+// literals or otherwise outlive the capture. Outside of a capture a zone costs one atomic load.
+class CpuProfiler {
+public:
+	static const size_t EVENTS_PER_THREAD = 1 << 16;
+
+	static CpuProfiler& instance() {
+		static CpuProfiler profiler;
+		return profiler;
+	}
+
+	bool isCapturing() const {
+		return capturing.load(std::memory_order_relaxed);
+	}
+
+	// Starts recording; a positive duration stops the capture and writes the trace on its own
+	// once that many seconds have passed (checked in update).
+	void startCapture(const std::string& path, double seconds = 0.0) {
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		for (auto& thread : threads) {
+			std::lock_guard<std::mutex> threadLock(thread->mutex);
+			thread->next = 0;
+			thread->wrapped = false;
+		}
+		tracePath = path;
+		captureEndUs = seconds > 0.0 ? nowUs() + static_cast<int64_t>(seconds * 1.0e6) : 0;
+		capturing.store(true, std::memory_order_relaxed);
+	}
+
+	bool stopCapture() {
+		capturing.store(false, std::memory_order_relaxed);
+		return writeTrace(tracePath);
+	}
+
+	// Call once per frame from the main thread.
+	void update() {
+		if (isCapturing() && captureEndUs != 0 && nowUs() >= captureEndUs)
+			stopCapture();
+	}
+
+	// Names the calling thread in the trace.
+	void setThreadName(const std::string& name) {
+		ThreadBuffer& thread = localBuffer();
+		std::lock_guard<std::mutex> lock(thread.mutex);
+		thread.name = name;
+	}
+
+	void record(const char* name, int64_t startUs, int64_t endUs) {
+		ThreadBuffer& thread = localBuffer();
+		std::lock_guard<std::mutex> lock(thread.mutex);
+		thread.events[thread.next] = { name, startUs, endUs };
+		thread.next = (thread.next + 1) % EVENTS_PER_THREAD;
+		if (thread.next == 0)
+			thread.wrapped = true;
+	}
+
+	bool writeTrace(const std::string& path) {
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		if (!out.is_open())
+			return false;
+
+		out << "{\"traceEvents\":[\n";
+		bool first = true;
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		for (auto& thread : threads) {
+			std::lock_guard<std::mutex> threadLock(thread->mutex);
+			if (!thread->name.empty()) {
+				out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id
+					<< ",\"args\":{\"name\":\"" << thread->name << "\"}}";
+				first = false;
+			}
+
+			size_t count = thread->wrapped ? EVENTS_PER_THREAD : thread->next;
+			size_t begin = thread->wrapped ? thread->next : 0;
+			for (size_t i = 0; i < count; ++i) {
+				const CpuZoneEvent& event = thread->events[(begin + i) % EVENTS_PER_THREAD];
+				out << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+					<< ",\"ts\":" << event.startUs - originUs << ",\"dur\":" << event.endUs - event.startUs << "}";
+				first = false;
+			}
+		}
+		out << "\n]}\n";
+		return true;
+	}
+
+	static int64_t nowUs() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+private:
+	struct ThreadBuffer {
+		int id = 0;
+		std::string name;
+		std::vector<CpuZoneEvent> events;
+		size_t next = 0;
+		bool wrapped = false;
+		std::mutex mutex;
+	};
+
+	std::atomic<bool> capturing{ false };
+	std::string tracePath = "trace.json";
+	int64_t captureEndUs = 0;
+	int64_t originUs = nowUs();
+
+	std::mutex threadsMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> threads;
+
+	CpuProfiler() = default;
+
+	// Buffers stay owned by the profiler so a trace can still be written after their thread exits.
+	ThreadBuffer& localBuffer() {
+		thread_local ThreadBuffer* buffer = nullptr;
+		if (!buffer) {
+			std::unique_ptr<ThreadBuffer> created(new ThreadBuffer());
+			created->events.resize(EVENTS_PER_THREAD);
+			std::lock_guard<std::mutex> lock(threadsMutex);
+			created->id = static_cast<int>(threads.size()) + 1;
+			buffer = created.get();
+			threads.push_back(std::move(created));
+		}
+		return *buffer;
+	}
+};
+
+class CpuZone {
+public:
+	explicit CpuZone(const char* name) : name(name), startUs(0) {
+		if (CpuProfiler::instance().isCapturing())
+			startUs = CpuProfiler::nowUs();
+	}
+
+	~CpuZone() {
+		if (startUs != 0 && CpuProfiler::instance().isCapturing())
+			CpuProfiler::instance().record(name, startUs, CpuProfiler::nowUs());
+	}
+
+private:
+	const char* name;
+	int64_t startUs;
+};
+
+#define CPU_ZONE_CONCAT_INNER(a, b) a##b
+#define CPU_ZONE_CONCAT(a, b) CPU_ZONE_CONCAT_INNER(a, b)
+// Times the rest of the enclosing block as a zone called name.
+#define CPU_ZONE(name) CpuZone CPU_ZONE_CONCAT(cpuZone, __LINE__)(name)
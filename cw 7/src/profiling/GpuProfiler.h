@@ -0,0 +1,189 @@
+#pragma once
+#include "glew.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct GpuPassStats {
+	std::string name;
+	float lastMs = 0.0f;
+	float averageMs = 0.0f;
+	float p99Ms = 0.0f;
+};
+
+// Named GPU timing scopes on GL_TIME_ELAPSED queries. Queries of a frame are read back
+// FRAMES_IN_FLIGHT frames later and only if already available, so the CPU never waits for
+// the GPU. Scopes cannot nest (a GL limitation of GL_TIME_ELAPSED); a pass timed by several
+// scopes in one frame is reported as their sum. When disabled, begin/end only test a flag.
+class GpuProfiler {
+public:
+	static const int FRAMES_IN_FLIGHT = 3;
+	static const int HISTORY_SIZE = 240;
+
+	bool enabled = false;
+
+	void beginFrame() {
+		if (!enabled)
+			return;
+
+		frameIndex++;
+		FrameQueries& frame = frames[frameIndex % FRAMES_IN_FLIGHT];
+		if (frame.used > 0)
+			resolve(frame);
+		frame.used = 0;
+		frame.frameNumber = frameIndex;
+	}
+
+	void begin(const char* name) {
+		if (!enabled || activeScope)
+			return;
+
+		FrameQueries& frame = frames[frameIndex % FRAMES_IN_FLIGHT];
+		if (frame.used == frame.queries.size()) {
+			GLuint query;
+			glGenQueries(1, &query);
+			frame.queries.push_back(query);
+			frame.passes.push_back(0);
+		}
+		frame.passes[frame.used] = passIndex(name);
+		glBeginQuery(GL_TIME_ELAPSED, frame.queries[frame.used]);
+		frame.used++;
+		activeScope = true;
+	}
+
+	void end() {
+		if (!activeScope)
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		activeScope = false;
+	}
+
+	// Appends one "frame,pass,ms" row per timed pass to path until stopCsvLog.
+	bool startCsvLog(const std::string& path) {
+		csv.open(path, std::ios::out | std::ios::trunc);
+		if (!csv.is_open())
+			return false;
+		csv << "frame,pass,ms\n";
+		return true;
+	}
+
+	void stopCsvLog() {
+		if (csv.is_open())
+			csv.close();
+	}
+
+	bool isLogging() const {
+		return csv.is_open();
+	}
+
+	const std::vector<GpuPassStats>& getStats() const {
+		return stats;
+	}
+
+	void destroy() {
+		for (FrameQueries& frame : frames) {
+			if (!frame.queries.empty())
+				glDeleteQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+			frame.queries.clear();
+			frame.passes.clear();
+			frame.used = 0;
+		}
+		stopCsvLog();
+	}
+
+private:
+	struct FrameQueries {
+		std::vector<GLuint> queries;
+		std::vector<int> passes;
+		size_t used = 0;
+		unsigned long long frameNumber = 0;
+	};
+
+	struct PassHistory {
+		float samples[HISTORY_SIZE] = {};
+		int count = 0;
+		int next = 0;
+	};
+
+	FrameQueries frames[FRAMES_IN_FLIGHT];
+	unsigned long long frameIndex = 0;
+	bool activeScope = false;
+
+	std::vector<GpuPassStats> stats;
+	std::vector<PassHistory> history;
+	std::vector<float> frameTotals;
+	std::vector<float> sortScratch;
+	std::ofstream csv;
+
+	int passIndex(const char* name) {
+		for (size_t i = 0; i < stats.size(); ++i) {
+			if (stats[i].name == name)
+				return static_cast<int>(i);
+		}
+		GpuPassStats pass;
+		pass.name = name;
+		stats.push_back(pass);
+		history.emplace_back();
+		return static_cast<int>(stats.size() - 1);
+	}
+
+	void resolve(FrameQueries& frame) {
+		// the last query of a frame finishes last, so if it is not ready the frame is dropped
+		GLint available = 0;
+		glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return;
+
+		frameTotals.assign(stats.size(), -1.0f);
+		for (size_t i = 0; i < frame.used; ++i) {
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &elapsed);
+			float& total = frameTotals[frame.passes[i]];
+			total = std::max(total, 0.0f) + elapsed / 1.0e6f;
+		}
+
+		for (size_t pass = 0; pass < frameTotals.size(); ++pass) {
+			if (frameTotals[pass] < 0.0f)
+				continue;
+			addSample(static_cast<int>(pass), frameTotals[pass]);
+			if (csv.is_open())
+				csv << frame.frameNumber << ',' << stats[pass].name << ',' << frameTotals[pass] << '\n';
+		}
+	}
+
+	void addSample(int pass, float ms) {
+		PassHistory& h = history[pass];
+		h.samples[h.next] = ms;
+		h.next = (h.next + 1) % HISTORY_SIZE;
+		h.count = std::min(h.count + 1, (int)HISTORY_SIZE);
+
+		sortScratch.assign(h.samples, h.samples + h.count);
+		float sum = 0.0f;
+		for (float sample : sortScratch)
+			sum += sample;
+		size_t p99 = std::min(sortScratch.size() - 1, static_cast<size_t>(sortScratch.size() * 0.99f));
+		std::nth_element(sortScratch.begin(), sortScratch.begin() + p99, sortScratch.end());
+
+		stats[pass].lastMs = ms;
+		stats[pass].averageMs = sum / h.count;
+		stats[pass].p99Ms = sortScratch[p99];
+	}
+};
+
+// Times the enclosing block as one GPU pass.
+class GpuScope {
+public:
+	GpuScope(GpuProfiler& profiler, const char* name) : profiler(profiler) {
+		profiler.begin(name);
+	}
+
+	~GpuScope() {
+		profiler.end();
+	}
+
+private:
+	GpuProfiler& profiler;
+};
@@ -0,0 +1,180 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CpuProfiler.h"
+
+// Collects how long each phase of startup takes, from process start until every asset is on
+// the GPU. Phases may run on any thread; a phase seen several times (e.g. every shader link)
+// is reported once with its count and summed time. Milestones are points in time measured
+// from start(). After finish() nothing more is recorded, so the per-frame code paths that
+// also carry phases cost only a check of the flag.
+class StartupReport {
+public:
+	static StartupReport& instance() {
+		static StartupReport report;
+		return report;
+	}
+
+	// Call first thing in main, on the main thread.
+	void start() {
+		std::lock_guard<std::mutex> lock(mutex);
+		originUs = CpuProfiler::nowUs();
+		mainThread = std::this_thread::get_id();
+		phases.clear();
+		milestones.clear();
+		recording.store(true);
+	}
+
+	bool isRecording() const {
+		return recording.load(std::memory_order_relaxed);
+	}
+
+	void record(const char* name, int64_t startUs, int64_t endUs) {
+		bool onMain = std::this_thread::get_id() == mainThread;
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!isRecording())
+			return;
+		for (Phase& phase : phases) {
+			if (std::strcmp(phase.name, name) == 0 && phase.mainThread == onMain) {
+				phase.count++;
+				phase.totalUs += endUs - startUs;
+				phase.firstUs = std::min(phase.firstUs, startUs);
+				phase.lastUs = std::max(phase.lastUs, endUs);
+				return;
+			}
+		}
+		phases.push_back({ name, onMain, 1, endUs - startUs, startUs, endUs });
+	}
+
+	void mark(const char* name) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (isRecording())
+			milestones.push_back({ name, CpuProfiler::nowUs() });
+	}
+
+	// Closes the report with a "total" milestone.
+	void finish() {
+		mark("total");
+		std::lock_guard<std::mutex> lock(mutex);
+		recording.store(false);
+	}
+
+	void print(std::ostream& out) {
+		std::lock_guard<std::mutex> lock(mutex);
+		out << "startup phases (ms since start, duration ms, thread):" << std::endl;
+		for (const Phase& phase : sortedPhases()) {
+			out << "  " << std::left << std::setw(28) << phase.name << std::right << std::fixed << std::setprecision(1)
+				<< std::setw(9) << (phase.firstUs - originUs) / 1000.0
+				<< std::setw(9) << phase.totalUs / 1000.0
+				<< "  " << (phase.mainThread ? "main" : "worker");
+			if (phase.count > 1)
+				out << " x" << phase.count;
+			out << std::endl;
+		}
+		for (const Milestone& milestone : milestones)
+			out << "startup: " << milestone.name << " after " << std::fixed << std::setprecision(1)
+				<< (milestone.timeUs - originUs) / 1000.0 << " ms" << std::endl;
+		out.unsetf(std::ios::floatfield);
+	}
+
+	bool writeJson(const std::string& path) {
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		if (!out.is_open())
+			return false;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		out << "{\n\"milestones\":[";
+		for (size_t i = 0; i < milestones.size(); ++i)
+			out << (i ? ",\n" : "\n") << "{\"name\":\"" << milestones[i].name << "\",\"ms\":" << (milestones[i].timeUs - originUs) / 1000.0 << "}";
+		out << "\n],\n\"phases\":[";
+		std::vector<Phase> sorted = sortedPhases();
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			const Phase& phase = sorted[i];
+			out << (i ? ",\n" : "\n") << "{\"name\":\"" << phase.name << "\",\"thread\":\"" << (phase.mainThread ? "main" : "worker")
+				<< "\",\"count\":" << phase.count
+				<< ",\"startMs\":" << (phase.firstUs - originUs) / 1000.0
+				<< ",\"endMs\":" << (phase.lastUs - originUs) / 1000.0
+				<< ",\"durationMs\":" << phase.totalUs / 1000.0 << "}";
+		}
+		out << "\n]\n}\n";
+		return true;
+	}
+
+	// Reads one milestone back from a report written by writeJson, -1 if it is missing.
+	static double readMilestone(const std::string& path, const std::string& name) {
+		std::ifstream in(path);
+		std::stringstream contents;
+		contents << in.rdbuf();
+		std::string key = "{\"name\":\"" + name + "\",\"ms\":";
+		std::string json = contents.str();
+		size_t at = json.find(key);
+		if (at == std::string::npos)
+			return -1.0;
+		return std::atof(json.c_str() + at + key.size());
+	}
+
+private:
+	struct Phase {
+		const char* name;
+		bool mainThread;
+		int count;
+		int64_t totalUs;
+		int64_t firstUs;
+		int64_t lastUs;
+	};
+
+	struct Milestone {
+		const char* name;
+		int64_t timeUs;
+	};
+
+	std::mutex mutex;
+	std::atomic<bool> recording{ false };
+	int64_t originUs = CpuProfiler::nowUs();
+	std::thread::id mainThread;
+	std::vector<Phase> phases;
+	std::vector<Milestone> milestones;
+
+	StartupReport() = default;
+
+	std::vector<Phase> sortedPhases() const {
+		std::vector<Phase> sorted = phases;
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Phase& a, const Phase& b) {
+			return a.firstUs < b.firstUs;
+		});
+		return sorted;
+	}
+};
+
+// Times the enclosing scope as a startup phase; it is also a CPU zone of the trace.
+class StartupPhase {
+public:
+	explicit StartupPhase(const char* name) : name(name), zone(name), startUs(0) {
+		if (StartupReport::instance().isRecording())
+			startUs = CpuProfiler::nowUs();
+	}
+
+	~StartupPhase() {
+		if (startUs != 0)
+			StartupReport::instance().record(name, startUs, CpuProfiler::nowUs());
+	}
+
+private:
+	const char* name;
+	CpuZone zone;
+	int64_t startUs;
+};
+
+#define STARTUP_PHASE(name) StartupPhase CPU_ZONE_CONCAT(startupPhase, __LINE__)(name)
@@ -0,0 +1,148 @@
+#pragma once
+#include "glew.h"
+#include "glm.hpp"
+#include "ext.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "FrameGraph.h"
+
+// Shadow map split into several cascades along the camera frustum. Each cascade is
+// a layer of one depth texture array, fitted to its slice of the frustum.
+class CascadedShadowMap {
+public:
+	static const int MAX_CASCADES = 4;
+
+	int cascadeCount;
+	int resolution;
+	float splitLambda = 0.75f;
+	float shadowDistance = 200.0f;
+	float casterMargin = 150.0f;
+
+	GLuint depthMapFBO = 0;
+	// depth array of the current frame, a transient texture owned by the frame graph; 0 until
+	// the depth pass of the frame runs, and for the whole frame when the pass is culled
+	GLuint depthMapArray = 0;
+
+	glm::mat4 lightSpaceMatrices[MAX_CASCADES];
+	float cascadeSplits[MAX_CASCADES];
+	float cascadeDepthBias[MAX_CASCADES];
+
+	CascadedShadowMap(int cascades = 4, int res = 1024)
+		: cascadeCount(glm::clamp(cascades, 1, (int)MAX_CASCADES)), resolution(res) {
+	}
+
+	void init() {
+		glGenFramebuffers(1, &depthMapFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	TransientTextureDesc depthTargetDesc() const {
+		TransientTextureDesc desc;
+		desc.target = GL_TEXTURE_2D_ARRAY;
+		desc.internalFormat = GL_DEPTH_COMPONENT24;
+		desc.width = resolution;
+		desc.height = resolution;
+		desc.layers = cascadeCount;
+		return desc;
+	}
+
+	// Splits [cameraNear, shadowDistance] between the cascades and fits an orthographic
+	// light projection around each slice. The fit uses a bounding sphere so the projection
+	// size does not change with camera rotation, and is snapped to whole texels so shadow
+	// edges do not shimmer when the camera moves.
+	void update(const glm::mat4& view, const glm::mat4& projection, float cameraNear, float cameraFar, glm::vec3 lightDir) {
+		// last frame's transient may be reused for something else by now
+		depthMapArray = 0;
+		lightDir = glm::normalize(lightDir);
+		float farDistance = std::min(shadowDistance, cameraFar);
+
+		glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+		glm::vec3 nearCorners[4], farCorners[4];
+		for (int i = 0; i < 4; ++i) {
+			glm::vec2 ndc((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f);
+			glm::vec4 nearCorner = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+			glm::vec4 farCorner = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+			nearCorners[i] = glm::vec3(nearCorner) / nearCorner.w;
+			farCorners[i] = glm::vec3(farCorner) / farCorner.w;
+		}
+
+		float sliceStart = cameraNear;
+		for (int c = 0; c < cascadeCount; ++c) {
+			float p = (c + 1) / static_cast<float>(cascadeCount);
+			float logSplit = cameraNear * std::pow(farDistance / cameraNear, p);
+			float uniformSplit = cameraNear + (farDistance - cameraNear) * p;
+			float sliceEnd = glm::mix(uniformSplit, logSplit, splitLambda);
+
+			glm::vec3 corners[8];
+			glm::vec3 center(0.0f);
+			for (int i = 0; i < 4; ++i) {
+				glm::vec3 ray = farCorners[i] - nearCorners[i];
+				corners[i] = nearCorners[i] + ray * ((sliceStart - cameraNear) / (cameraFar - cameraNear));
+				corners[i + 4] = nearCorners[i] + ray * ((sliceEnd - cameraNear) / (cameraFar - cameraNear));
+				center += corners[i] + corners[i + 4];
+			}
+			center /= 8.0f;
+
+			float radius = 0.0f;
+			for (int i = 0; i < 8; ++i)
+				radius = std::max(radius, glm::length(corners[i] - center));
+			radius = std::ceil(radius * 16.0f) / 16.0f;
+
+			glm::vec3 up = std::abs(lightDir.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+			glm::mat4 lightView = glm::lookAt(center - lightDir * radius, center, up);
+			float depthRange = 2.0f * radius + casterMargin;
+			glm::mat4 lightProjection = glm::ortho(-radius, radius, -radius, radius, -casterMargin, 2.0f * radius);
+
+			glm::vec4 shadowOrigin = lightProjection * lightView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			shadowOrigin *= resolution / 2.0f;
+			glm::vec2 roundOffset = (glm::round(glm::vec2(shadowOrigin)) - glm::vec2(shadowOrigin)) * (2.0f / resolution);
+			lightProjection[3][0] += roundOffset.x;
+			lightProjection[3][1] += roundOffset.y;
+
+			lightSpaceMatrices[c] = lightProjection * lightView;
+			cascadeSplits[c] = sliceEnd;
+			cascadeDepthBias[c] = (2.0f * radius / resolution) / depthRange;
+
+			sliceStart = sliceEnd;
+		}
+	}
+
+	// Binds the framebuffer with all cascades of depthArray (see depthTargetDesc) attached at once.
+	// Casters pick their cascade through gl_Layer in depth_shader.geom, so each one needs a
+	// single draw for all cascades.
+	void beginDepthPass(GLuint depthArray) {
+		depthMapArray = depthArray;
+		glViewport(0, 0, resolution, resolution);
+		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMapArray, 0);
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+
+	// Expects shaderProgram to be in use.
+	void bindLightSpace(GLuint shaderProgram) const {
+		glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "lightSpaceMatrices"), cascadeCount, GL_FALSE, glm::value_ptr(lightSpaceMatrices[0]));
+		glUniform1i(glGetUniformLocation(shaderProgram, "cascadeCount"), cascadeCount);
+	}
+
+	// Expects shaderProgram to be in use and depthMapArray bound to textureUnit. Without a
+	// depth pass this frame no cascade is selected, so nothing is in shadow.
+	void setUniforms(GLuint shaderProgram, int textureUnit) const {
+		bindLightSpace(shaderProgram);
+		if (depthMapArray == 0)
+			glUniform1i(glGetUniformLocation(shaderProgram, "cascadeCount"), 0);
+		glUniform1fv(glGetUniformLocation(shaderProgram, "cascadeSplits"), cascadeCount, cascadeSplits);
+		glUniform1fv(glGetUniformLocation(shaderProgram, "cascadeDepthBias"), cascadeCount, cascadeDepthBias);
+		glUniform1i(glGetUniformLocation(shaderProgram, "shadowMap"), textureUnit);
+	}
+
+	void destroy() {
+		glDeleteFramebuffers(1, &depthMapFBO);
+		depthMapFBO = 0;
+		depthMapArray = 0;
+	}
+};
@@ -0,0 +1,356 @@
+#pragma once
+#include "glew.h"
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct TransientTextureDesc {
+	GLenum target = GL_TEXTURE_2D;
+	GLenum internalFormat = GL_RGBA8;
+	int width = 0;
+	int height = 0;
+	// array layers, only used by GL_TEXTURE_2D_ARRAY
+	int layers = 1;
+
+	bool operator==(const TransientTextureDesc& other) const {
+		return target == other.target && internalFormat == other.internalFormat &&
+			width == other.width && height == other.height && layers == other.layers;
+	}
+};
+
+// Per-frame graph of render passes. Passes declare the resources they read and write; the
+// graph orders them so every reader runs after the writers of what it reads, culls passes
+// whose results nothing uses, and gives transient textures a pooled GL texture only for the
+// span of passes that use them. Rebuilt every frame: reset, declare, compile, execute.
+class FrameGraph {
+public:
+	typedef int ResourceHandle;
+
+	class PassBuilder {
+	public:
+		ResourceHandle read(ResourceHandle resource) {
+			graph.passes[pass].reads.push_back(resource);
+			return resource;
+		}
+
+		ResourceHandle write(ResourceHandle resource) {
+			graph.passes[pass].writes.push_back(resource);
+			return resource;
+		}
+
+	private:
+		friend class FrameGraph;
+		PassBuilder(FrameGraph& graph, int pass) : graph(graph), pass(pass) {}
+
+		FrameGraph& graph;
+		int pass;
+	};
+
+	int executedPasses = 0;
+	int culledPasses = 0;
+
+	void reset() {
+		resources.clear();
+		passes.clear();
+		order.clear();
+	}
+
+	// Resource owned outside the graph, such as the window framebuffer.
+	ResourceHandle importResource(const std::string& name, GLuint texture = 0) {
+		Resource resource;
+		resource.name = name;
+		resource.texture = texture;
+		resources.push_back(resource);
+		return static_cast<ResourceHandle>(resources.size() - 1);
+	}
+
+	ResourceHandle createTransient(const std::string& name, const TransientTextureDesc& desc) {
+		Resource resource;
+		resource.name = name;
+		resource.transient = true;
+		resource.desc = desc;
+		resources.push_back(resource);
+		return static_cast<ResourceHandle>(resources.size() - 1);
+	}
+
+	// Marks a resource as a result of the frame, so the passes producing it are never culled.
+	void markOutput(ResourceHandle resource) {
+		resources[resource].output = true;
+	}
+
+	void addPass(const std::string& name, const std::function<void(PassBuilder&)>& setup,
+		std::function<void(const FrameGraph&)> execute)
+	{
+		Pass pass;
+		pass.name = name;
+		pass.execute = std::move(execute);
+		passes.push_back(std::move(pass));
+
+		PassBuilder builder(*this, static_cast<int>(passes.size() - 1));
+		setup(builder);
+	}
+
+	// Valid inside the execute callback of a pass that declared the resource.
+	GLuint getTexture(ResourceHandle resource) const {
+		return resources[resource].texture;
+	}
+
+	void compile() {
+		cullPasses();
+		sortPasses();
+
+		for (Resource& resource : resources) {
+			resource.firstUse = -1;
+			resource.lastUse = -1;
+		}
+		for (int step = 0; step < static_cast<int>(order.size()); ++step) {
+			const Pass& pass = passes[order[step]];
+			for (const std::vector<ResourceHandle>* list : { &pass.reads, &pass.writes }) {
+				for (ResourceHandle handle : *list) {
+					Resource& resource = resources[handle];
+					if (resource.firstUse < 0)
+						resource.firstUse = step;
+					resource.lastUse = step;
+				}
+			}
+		}
+	}
+
+	void execute() {
+		executedPasses = 0;
+		for (int step = 0; step < static_cast<int>(order.size()); ++step) {
+			for (Resource& resource : resources) {
+				if (resource.transient && resource.firstUse == step)
+					resource.texture = acquire(resource.desc);
+			}
+
+			passes[order[step]].execute(*this);
+			executedPasses++;
+
+			for (Resource& resource : resources) {
+				if (resource.transient && resource.lastUse == step)
+					release(resource.texture);
+			}
+		}
+		trimPool();
+	}
+
+	void destroy() {
+		for (PooledTexture& pooled : pool)
+			glDeleteTextures(1, &pooled.texture);
+		pool.clear();
+	}
+
+private:
+	// textures not used for this many frames are deleted
+	static const int POOL_MAX_IDLE_FRAMES = 60;
+
+	struct Resource {
+		std::string name;
+		bool transient = false;
+		bool output = false;
+		TransientTextureDesc desc;
+		GLuint texture = 0;
+		int firstUse = -1;
+		int lastUse = -1;
+	};
+
+	struct Pass {
+		std::string name;
+		std::vector<ResourceHandle> reads;
+		std::vector<ResourceHandle> writes;
+		std::function<void(const FrameGraph&)> execute;
+		bool culled = false;
+	};
+
+	struct PooledTexture {
+		TransientTextureDesc desc;
+		GLuint texture = 0;
+		bool inUse = false;
+		int idleFrames = 0;
+	};
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<int> order;
+	std::vector<PooledTexture> pool;
+
+	// A pass survives if it writes an output or a resource read by a surviving pass.
+	void cullPasses() {
+		std::vector<bool> needed(resources.size(), false);
+		for (size_t r = 0; r < resources.size(); ++r)
+			needed[r] = resources[r].output;
+
+		for (Pass& pass : passes)
+			pass.culled = true;
+
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (Pass& pass : passes) {
+				if (!pass.culled)
+					continue;
+				for (ResourceHandle handle : pass.writes) {
+					if (needed[handle]) {
+						pass.culled = false;
+						break;
+					}
+				}
+				if (pass.culled)
+					continue;
+				changed = true;
+				for (ResourceHandle handle : pass.reads)
+					needed[handle] = true;
+			}
+		}
+
+		culledPasses = 0;
+		for (const Pass& pass : passes) {
+			if (pass.culled)
+				culledPasses++;
+		}
+	}
+
+	static bool contains(const std::vector<ResourceHandle>& list, ResourceHandle handle) {
+		for (ResourceHandle item : list) {
+			if (item == handle)
+				return true;
+		}
+		return false;
+	}
+
+	bool readsOutputOf(int b, int a) const {
+		for (ResourceHandle handle : passes[b].reads) {
+			if (contains(passes[a].writes, handle))
+				return true;
+		}
+		return false;
+	}
+
+	// b runs after a if it reads something a writes. Passes writing the same resource keep their
+	// declaration order, unless the earlier one reads the later one's output.
+	bool dependsOn(int b, int a) const {
+		if (readsOutputOf(b, a))
+			return true;
+		if (a > b || readsOutputOf(a, b))
+			return false;
+		for (ResourceHandle handle : passes[b].writes) {
+			if (contains(passes[a].writes, handle))
+				return true;
+		}
+		return false;
+	}
+
+	void sortPasses() {
+		int count = static_cast<int>(passes.size());
+		std::vector<int> pending(count, 0);
+		for (int b = 0; b < count; ++b) {
+			for (int a = 0; a < count; ++a) {
+				if (a != b && !passes[a].culled && !passes[b].culled && dependsOn(b, a))
+					pending[b]++;
+			}
+		}
+
+		order.clear();
+		std::vector<bool> scheduled(count, false);
+		while (true) {
+			// the earliest declared pass whose dependencies have all run
+			int next = -1;
+			for (int p = 0; p < count; ++p) {
+				if (!passes[p].culled && !scheduled[p] && pending[p] == 0) {
+					next = p;
+					break;
+				}
+			}
+			if (next < 0)
+				break;
+
+			scheduled[next] = true;
+			order.push_back(next);
+			for (int b = 0; b < count; ++b) {
+				if (b != next && !passes[b].culled && !scheduled[b] && dependsOn(b, next))
+					pending[b]--;
+			}
+		}
+
+		if (static_cast<int>(order.size()) + culledPasses != count) {
+			std::cout << "FrameGraph: dependency cycle, running passes in declaration order" << std::endl;
+			order.clear();
+			for (int p = 0; p < count; ++p) {
+				if (!passes[p].culled)
+					order.push_back(p);
+			}
+		}
+	}
+
+	GLuint acquire(const TransientTextureDesc& desc) {
+		for (PooledTexture& pooled : pool) {
+			if (!pooled.inUse && pooled.desc == desc) {
+				pooled.inUse = true;
+				pooled.idleFrames = 0;
+				return pooled.texture;
+			}
+		}
+
+		PooledTexture pooled;
+		pooled.desc = desc;
+		pooled.texture = createTexture(desc);
+		pooled.inUse = true;
+		pool.push_back(pooled);
+		return pooled.texture;
+	}
+
+	void release(GLuint texture) {
+		for (PooledTexture& pooled : pool) {
+			if (pooled.texture == texture)
+				pooled.inUse = false;
+		}
+	}
+
+	void trimPool() {
+		for (size_t i = 0; i < pool.size();) {
+			if (!pool[i].inUse && ++pool[i].idleFrames > POOL_MAX_IDLE_FRAMES) {
+				glDeleteTextures(1, &pool[i].texture);
+				pool.erase(pool.begin() + i);
+			}
+			else {
+				++i;
+			}
+		}
+	}
+
+	static GLuint createTexture(const TransientTextureDesc& desc) {
+		bool depth = desc.internalFormat == GL_DEPTH_COMPONENT16 || desc.internalFormat == GL_DEPTH_COMPONENT24 ||
+			desc.internalFormat == GL_DEPTH_COMPONENT32F;
+		GLenum format = depth ? GL_DEPTH_COMPONENT : GL_RGBA;
+		GLenum type = depth ? GL_FLOAT : GL_UNSIGNED_BYTE;
+
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(desc.target, texture);
+		if (desc.target == GL_TEXTURE_2D_ARRAY)
+			glTexImage3D(desc.target, 0, desc.internalFormat, desc.width, desc.height, desc.layers, 0, format, type, NULL);
+		else
+			glTexImage2D(desc.target, 0, desc.internalFormat, desc.width, desc.height, 0, format, type, NULL);
+
+		if (depth) {
+			// depth targets are sampled as shadow maps: everything outside the map is lit
+			float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+			glTexParameteri(desc.target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(desc.target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(desc.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+			glTexParameteri(desc.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+			glTexParameterfv(desc.target, GL_TEXTURE_BORDER_COLOR, borderColor);
+		}
+		else {
+			glTexParameteri(desc.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(desc.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(desc.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(desc.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+		glBindTexture(desc.target, 0);
+		return texture;
+	}
+};
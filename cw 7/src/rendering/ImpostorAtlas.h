@@ -0,0 +1,125 @@
+#pragma once
+#include "glew.h"
+#include "glm.hpp"
+#include "ext.hpp"
+
+#include "../Render_Utils.h"
+
+// Views of a model pre-rendered into a grid of atlas tiles, one tile per direction of an
+// octahedral map over the whole sphere. Instead of colour the tiles store the model's texture
+// coordinates and object-space normals (two render targets), so an impostor can still be
+// textured per instance and lit like the mesh. impostor.vert picks the tile nearest to the
+// viewing direction and builds its billboard with the same basis as bake.
+class ImpostorAtlas {
+public:
+	int tilesPerSide;
+	int tileResolution;
+	float radius = 1.0f;
+
+	GLuint uvTexture = 0;
+	GLuint normalTexture = 0;
+
+	ImpostorAtlas(int tiles = 8, int tileRes = 64) : tilesPerSide(tiles), tileResolution(tileRes) {
+	}
+
+	void bake(const Core::RenderContext& context, GLuint bakeShader) {
+		int size = tilesPerSide * tileResolution;
+		radius = context.boundingRadius;
+
+		uvTexture = createTarget(GL_RG16F, GL_RG, size);
+		normalTexture = createTarget(GL_RGBA8, GL_RGBA, size);
+
+		GLuint framebuffer, depthBuffer;
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(1, &depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, uvTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+		GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, drawBuffers);
+
+		// alpha 0 in the normal target marks texels the model does not cover
+		glViewport(0, 0, size, size);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		GLuint vertexArray = createBakeVertexArray(context);
+		glUseProgram(bakeShader);
+		glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 4.0f * radius);
+		for (int y = 0; y < tilesPerSide; ++y) {
+			for (int x = 0; x < tilesPerSide; ++x) {
+				glm::vec3 direction = tileDirection(x, y);
+				glm::mat4 view = glm::lookAt(direction * 2.0f * radius, glm::vec3(0.0f), upReference(direction));
+				glm::mat4 viewProjection = projection * view;
+
+				glViewport(x * tileResolution, y * tileResolution, tileResolution, tileResolution);
+				glUniformMatrix4fv(glGetUniformLocation(bakeShader, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+				glDrawElementsBaseVertex(GL_TRIANGLES, context.size, GL_UNSIGNED_INT,
+					(void*)(sizeof(unsigned int) * context.firstIndex), context.baseVertex);
+			}
+		}
+
+		glBindVertexArray(0);
+		glUseProgram(0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteVertexArrays(1, &vertexArray);
+		glDeleteRenderbuffers(1, &depthBuffer);
+		glDeleteFramebuffers(1, &framebuffer);
+	}
+
+	// Expects shaderProgram to be in use and the atlas bound to the given units.
+	void setUniforms(GLuint shaderProgram, int uvUnit, int normalUnit) const {
+		glUniform1i(glGetUniformLocation(shaderProgram, "impostorUV"), uvUnit);
+		glUniform1i(glGetUniformLocation(shaderProgram, "impostorNormal"), normalUnit);
+		glUniform1i(glGetUniformLocation(shaderProgram, "impostorTiles"), tilesPerSide);
+		glUniform1f(glGetUniformLocation(shaderProgram, "impostorRadius"), radius);
+	}
+
+	void destroy() {
+		glDeleteTextures(1, &uvTexture);
+		glDeleteTextures(1, &normalTexture);
+		uvTexture = 0;
+		normalTexture = 0;
+	}
+
+private:
+	static GLuint createTarget(GLenum internalFormat, GLenum format, int size) {
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size, 0, format, GL_UNSIGNED_BYTE, NULL);
+		// interpolating stored texture coordinates across the silhouette would produce garbage
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+
+	// A VAO of the bake's own, so it draws without any instance attributes set up on the context's VAOs.
+	static GLuint createBakeVertexArray(const Core::RenderContext& context) {
+		GLuint vertexArray;
+		glGenVertexArrays(1, &vertexArray);
+		glBindVertexArray(vertexArray);
+		context.bindVertexAttributes();
+		return vertexArray;
+	}
+
+	glm::vec3 tileDirection(int x, int y) const {
+		glm::vec2 p = (glm::vec2(x, y) + 0.5f) / static_cast<float>(tilesPerSide) * 2.0f - 1.0f;
+		glm::vec3 v(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+		if (v.z < 0.0f) {
+			v.x = (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+			v.y = (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		return glm::normalize(v);
+	}
+
+	static glm::vec3 upReference(const glm::vec3& direction) {
+		return std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	}
+};
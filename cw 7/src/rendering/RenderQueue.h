@@ -0,0 +1,247 @@
+#pragma once
+#include "glew.h"
+#include "glm.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "../profiling/GpuProfiler.h"
+
+enum class RenderLayer : uint8_t {
+	Opaque = 0,
+	// after opaque geometry, so sky pixels covered by it fail the depth test instead of being shaded
+	Background = 1,
+};
+
+enum class DepthState : uint8_t {
+	// GL_LESS with depth writes, the default for geometry
+	Opaque = 0,
+	// GL_LEQUAL without depth writes, used by the skybox drawn at the far plane
+	Background = 1,
+};
+
+struct TextureBinding {
+	GLenum target = GL_TEXTURE_2D;
+	GLuint id = 0;
+};
+
+struct DrawItem {
+	static const int MAX_TEXTURES = 4;
+
+	RenderLayer layer = RenderLayer::Opaque;
+	DepthState depthState = DepthState::Opaque;
+	GLuint program = 0;
+	GLuint vertexArray = 0;
+	TextureBinding textures[MAX_TEXTURES];
+
+	GLenum mode = GL_TRIANGLES;
+	GLsizei count = 0;
+	// GL_NONE draws non-indexed with glDrawArrays
+	GLenum indexType = GL_UNSIGNED_INT;
+	// first index (or first vertex for glDrawArrays) of the range to draw
+	GLuint firstIndex = 0;
+	// added to every index, lets meshes of the shared Core::MeshPool draw from one VAO
+	GLint baseVertex = 0;
+	GLsizei instanceCount = 1;
+
+	// when set, draws indirectCount DrawElementsIndirectCommands from this buffer in one
+	// glMultiDrawElementsIndirect call and ignores count, firstIndex, baseVertex and instanceCount
+	GLuint indirectBuffer = 0;
+	GLsizei indirectCount = 0;
+
+	// view depth of the object, used to draw front to back within the same state
+	float depth = 0.0f;
+
+	// sets the uniforms of this draw, called with the item's program in use
+	std::function<void(GLuint program)> setUniforms;
+	// changes the state of the bound vertexArray that differs between draws sharing it (e.g. the
+	// instance attribute offsets); called on every draw, with vertexArray bound
+	std::function<void()> prepareVertexState;
+
+	// GPU profiler pass the draw is timed under, untimed if null
+	const char* passName = nullptr;
+
+	uint64_t sortKey = 0;
+};
+
+// Layout of one glMultiDrawElementsIndirect command as read from GL_DRAW_INDIRECT_BUFFER.
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// Multi-draw-indirect needs GL 4.3 or both extensions below; the context itself is 3.3.
+inline bool multiDrawIndirectSupported() {
+	return GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+}
+
+struct RenderQueueStats {
+	int drawCalls = 0;
+	int programChanges = 0;
+	int vertexArrayChanges = 0;
+	int textureChanges = 0;
+	int depthStateChanges = 0;
+	int skippedStateChanges = 0;
+};
+
+// Collects the draws of a pass, sorts them by state and issues them skipping every
+// bind that would not change the current GL state.
+class RenderQueue {
+public:
+	RenderQueueStats stats;
+	RenderQueueStats lastFrameStats;
+	GpuProfiler* profiler = nullptr;
+	// called before a program is first bound in a flush, lets programs be linked on first use
+	std::function<void(GLuint program)> prepareProgram;
+
+	void beginFrame() {
+		lastFrameStats = stats;
+		stats = RenderQueueStats();
+	}
+
+	void submit(DrawItem item) {
+		if (item.indirectBuffer != 0 ? item.indirectCount == 0 : item.count == 0 || item.instanceCount == 0)
+			return;
+		item.sortKey = makeSortKey(item);
+		items.push_back(std::move(item));
+	}
+
+	// Sorts and draws everything submitted since the last flush into the bound framebuffer.
+	void flush() {
+		std::stable_sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) {
+			return a.sortKey < b.sortKey;
+		});
+
+		// GL state may have been changed by code outside the queue (e.g. ImGui) since the last flush
+		GLuint currentProgram = ~0u;
+		GLuint currentVertexArray = ~0u;
+		int currentDepthState = -1;
+		TextureBinding currentTextures[DrawItem::MAX_TEXTURES];
+		for (int unit = 0; unit < DrawItem::MAX_TEXTURES; ++unit)
+			currentTextures[unit].id = ~0u;
+
+		for (const DrawItem& item : items) {
+			if (currentDepthState != static_cast<int>(item.depthState)) {
+				applyDepthState(item.depthState);
+				currentDepthState = static_cast<int>(item.depthState);
+				stats.depthStateChanges++;
+			}
+			else {
+				stats.skippedStateChanges++;
+			}
+
+			if (currentProgram != item.program) {
+				if (prepareProgram)
+					prepareProgram(item.program);
+				glUseProgram(item.program);
+				currentProgram = item.program;
+				stats.programChanges++;
+			}
+			else {
+				stats.skippedStateChanges++;
+			}
+
+			if (currentVertexArray != item.vertexArray) {
+				glBindVertexArray(item.vertexArray);
+				currentVertexArray = item.vertexArray;
+				stats.vertexArrayChanges++;
+			}
+			else {
+				stats.skippedStateChanges++;
+			}
+			if (item.prepareVertexState)
+				item.prepareVertexState();
+
+			for (int unit = 0; unit < DrawItem::MAX_TEXTURES; ++unit) {
+				const TextureBinding& texture = item.textures[unit];
+				if (texture.id == 0)
+					continue;
+				if (currentTextures[unit].id != texture.id || currentTextures[unit].target != texture.target) {
+					glActiveTexture(GL_TEXTURE0 + unit);
+					glBindTexture(texture.target, texture.id);
+					currentTextures[unit] = texture;
+					stats.textureChanges++;
+				}
+				else {
+					stats.skippedStateChanges++;
+				}
+			}
+
+			if (item.setUniforms)
+				item.setUniforms(item.program);
+
+			if (profiler && item.passName)
+				profiler->begin(item.passName);
+
+			if (item.indirectBuffer != 0) {
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, item.indirectBuffer);
+				glMultiDrawElementsIndirect(item.mode, item.indexType, (const void*)0, item.indirectCount, 0);
+				glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			}
+			else if (item.indexType == GL_NONE) {
+				if (item.instanceCount > 1)
+					glDrawArraysInstanced(item.mode, item.firstIndex, item.count, item.instanceCount);
+				else
+					glDrawArrays(item.mode, item.firstIndex, item.count);
+			}
+			else {
+				const void* offset = (const void*)(static_cast<uintptr_t>(item.firstIndex) * indexSize(item.indexType));
+				if (item.instanceCount > 1)
+					glDrawElementsInstancedBaseVertex(item.mode, item.count, item.indexType, offset, item.instanceCount, item.baseVertex);
+				else
+					glDrawElementsBaseVertex(item.mode, item.count, item.indexType, offset, item.baseVertex);
+			}
+			stats.drawCalls++;
+
+			if (profiler && item.passName)
+				profiler->end();
+		}
+		items.clear();
+
+		applyDepthState(DepthState::Opaque);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+private:
+	std::vector<DrawItem> items;
+
+	// layer | depth state | program | vertex array | first texture | view depth
+	static uint64_t makeSortKey(const DrawItem& item) {
+		uint64_t depthBits = static_cast<uint64_t>(glm::clamp(item.depth / 1000.0f, 0.0f, 1.0f) * 1023.0f);
+		return (static_cast<uint64_t>(item.layer) & 0xF) << 60 |
+			(static_cast<uint64_t>(item.depthState) & 0x3) << 58 |
+			(static_cast<uint64_t>(item.program) & 0xFFF) << 46 |
+			(static_cast<uint64_t>(item.vertexArray) & 0xFFF) << 34 |
+			(static_cast<uint64_t>(item.textures[0].id) & 0xFFFFFF) << 10 |
+			depthBits;
+	}
+
+	static size_t indexSize(GLenum indexType) {
+		switch (indexType) {
+		case GL_UNSIGNED_BYTE:
+			return 1;
+		case GL_UNSIGNED_SHORT:
+			return 2;
+		default:
+			return 4;
+		}
+	}
+
+	static void applyDepthState(DepthState state) {
+		switch (state) {
+		case DepthState::Opaque:
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+			break;
+		case DepthState::Background:
+			glDepthFunc(GL_LEQUAL);
+			glDepthMask(GL_FALSE);
+			break;
+		}
+	}
+};
@@ -76,7 +76,9 @@ void drawSkybox() {
     glUniformMatrix4fv(glGetUniformLocation(skyboxShader, "viewProjection"), 1, GL_FALSE, &viewProjectionMatrix[0][0]);
 
     glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+    glBindVertexArray(Core::GetMeshPool().vertexArray);
     Core::DrawContext(skyboxCube);
+    glBindVertexArray(0);
 
     glDepthMask(GL_TRUE);
     glUseProgram(0);
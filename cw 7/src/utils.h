@@ -12,6 +12,7 @@
 
 #include <cstdlib>
 #include "boids/vertices.h"
+#include "rendering/RenderQueue.h"
 
 void setupBoidVAOandVBO(GLuint& VAO, GLuint& VBO, const float* vertices, size_t size) {
     glGenVertexArrays(1, &VAO);
@@ -49,21 +50,20 @@ void setupBoundingBox(GLuint& boundingBoxVAO, GLuint& boundingBoxVBO, GLuint& bo
     glBindVertexArray(0);
 }
 
-void drawBoundingBox(glm::mat4 view, glm::mat4 projection, GLuint lineShader, GLuint& boundingBoxVAO) {
-    glUseProgram(lineShader);
-
-    glm::mat4 model = glm::mat4(1.0f);
-    GLuint modelLoc = glGetUniformLocation(lineShader, "model");
-    GLuint viewLoc = glGetUniformLocation(lineShader, "view");
-    GLuint projectionLoc = glGetUniformLocation(lineShader, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    glBindVertexArray(boundingBoxVAO);
-    glDrawElements(GL_LINES, 24, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+void submitBoundingBox(RenderQueue& queue, glm::mat4 view, glm::mat4 projection, GLuint lineShader, GLuint boundingBoxVAO) {
+    DrawItem item;
+    item.program = lineShader;
+    item.vertexArray = boundingBoxVAO;
+    item.mode = GL_LINES;
+    item.count = 24;
+    item.passName = "Bounding box";
+    item.setUniforms = [view, projection](GLuint program) {
+        glm::mat4 model = glm::mat4(1.0f);
+        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    };
+    queue.submit(std::move(item));
 }
 
 #endif //UTILS_H